@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Arena.h"
+
+#define ARENA_ALIGN 16              // alignement suffisant pour tous les types
+#define ARENA_DEFAULT_SLAB (1 << 16) // 64 Ko
+
+// Les slabs sont chainés, le plus récent en tete
+typedef struct Slab_t
+{
+    struct Slab_t *next;
+    size_t size; // octets utilisables apres l'en-tete
+    size_t used;
+} Slab;
+
+struct Arena_t
+{
+    Slab *slabs;
+    size_t slabSize;
+};
+
+// Taille de l'en-tete arrondie pour que les données soient alignées
+#define SLAB_HEADER ((sizeof(Slab) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+static void terminate(char *m)
+{
+    printf("%s\n", m);
+    exit(EXIT_FAILURE);
+}
+
+static Slab *newSlab(size_t size)
+{
+    Slab *s = malloc(SLAB_HEADER + size);
+    if (s == NULL)
+        terminate("arenaAlloc: slab can not be allocated");
+    s->size = size;
+    s->used = 0;
+    return s;
+}
+
+Arena *arenaCreate(size_t slabSize)
+{
+    Arena *a = malloc(sizeof(Arena));
+    if (a == NULL)
+        terminate("arenaCreate: arena can not be created");
+
+    a->slabs = NULL;
+    a->slabSize = slabSize > 0 ? slabSize : ARENA_DEFAULT_SLAB;
+    return a;
+}
+
+void arenaFree(Arena *arena)
+{
+    if (arena == NULL)
+        return;
+
+    Slab *s = arena->slabs;
+    while (s != NULL)
+    {
+        Slab *next = s->next;
+        free(s);
+        s = next;
+    }
+    free(arena);
+}
+
+void *arenaAlloc(Arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if (size == 0)
+        size = ARENA_ALIGN;
+
+    Slab *s = arena->slabs;
+    if (s == NULL || s->size - s->used < size)
+    {
+        if (size > arena->slabSize / 4)
+        {
+            // grosse demande: un slab a part, placé derriere le slab courant
+            // pour ne pas perdre la place qui y reste
+            Slab *big = newSlab(size);
+            big->used = size;
+            if (s == NULL)
+            {
+                big->next = NULL;
+                arena->slabs = big;
+            }
+            else
+            {
+                big->next = s->next;
+                s->next = big;
+            }
+            return (char *)big + SLAB_HEADER;
+        }
+
+        s = newSlab(arena->slabSize);
+        s->next = arena->slabs;
+        arena->slabs = s;
+    }
+
+    void *p = (char *)s + SLAB_HEADER + s->used;
+    s->used += size;
+    return p;
+}
+
+char *arenaStrdup(Arena *arena, const char *s)
+{
+    size_t len = strlen(s);
+    char *copy = arenaAlloc(arena, len + 1);
+    memcpy(copy, s, len + 1);
+    return copy;
+}
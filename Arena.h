@@ -0,0 +1,47 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief Represents a bump allocator: memory is taken from large slabs and is
+ *        only given back all at once, by arenaFree.
+ */
+typedef struct Arena_t Arena;
+
+/**
+ * @brief Creates a new arena.
+ *
+ * @param slabSize the size in bytes of the slabs (0 for a default size). Larger
+ *                 requests get a slab of their own.
+ * @return Arena* the arena
+ */
+Arena *arenaCreate(size_t slabSize);
+
+/**
+ * @brief Frees the arena and all the memory allocated from it.
+ *
+ * @param arena the arena
+ */
+void arenaFree(Arena *arena);
+
+/**
+ * @brief Allocates size bytes from the arena, suitably aligned for any type. The
+ *        memory must not be freed with free.
+ *
+ * @param arena the arena
+ * @param size the number of bytes
+ * @return void* the allocated memory
+ */
+void *arenaAlloc(Arena *arena, size_t size);
+
+/**
+ * @brief Copies the string s into the arena.
+ *
+ * @param arena the arena
+ * @param s the string
+ * @return char* the copy
+ */
+char *arenaStrdup(Arena *arena, const char *s);
+
+#endif
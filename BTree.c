@@ -1,24 +1,46 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "BTree.h"
 
+#define BT_NONE UINT32_MAX // absence de lien
+#define BT_MAX_SEGMENTS 32
+
+// Les noeuds sont rangés dans un pool et reliés par leurs indices (32 bits).
+// Le pool est un tableau segmenté: le segment s contient base * 2^s noeuds, donc
+// un noeud ne change jamais d'adresse quand le pool grandit. Avec une capacité
+// suffisante, tous les noeuds sont dans le premier segment, contigu.
 struct BTNode_t
 {
-  BTNode *parent;
-  BTNode *left;
-  BTNode *right;
+  uint32_t self; // indice du noeud dans le pool
+  uint32_t parent;
+  uint32_t left;
+  uint32_t right;
+  uint32_t nbLeaves; // nombre de feuilles du sous-arbre
+  uint32_t height;   // longueur du plus long chemin vers une feuille du sous-arbre
   void *data;
 };
 
+struct BTPool_t
+{
+  BTNode *segments[BT_MAX_SEGMENTS];
+  uint32_t base;  // taille du premier segment
+  uint32_t nbSegments;
+  uint32_t used;  // nombre de noeuds alloués
+};
+
 struct BTree_t
 {
-  BTNode *root;
+  BTPool *pool;
+  uint32_t root;
   int size;
+  int ownsPool; // 1 si le pool est propre a l'arbre (btCreate)
 };
 
 static void terminate(char *m);
-static void FreeNodesRec(BTNode *n);
-static BTNode *createNode(void *data);
+static BTNode *nodeAt(BTPool *pool, uint32_t i);
+static BTNode *createNode(BTPool *pool, void *data);
+static uint32_t copyInto(BTPool *dst, BTree *src);
 
 static void terminate(char *m)
 {
@@ -26,90 +48,194 @@ static void terminate(char *m)
   exit(EXIT_FAILURE);
 }
 
-BTree *btCreate(void)
+/// Pool ///
+
+BTPool *btPoolCreate(int capacity)
 {
-  BTree *tree = malloc(sizeof(BTree));
-  if (!tree)
-    terminate("btCreate: tree can not be created");
-  tree->root = NULL;
-  tree->size = 0;
-  return tree;
+  BTPool *pool = malloc(sizeof(BTPool));
+  if (!pool)
+    terminate("btPoolCreate: pool can not be created");
+
+  pool->base = capacity > 0 ? (uint32_t)capacity : 1;
+  pool->segments[0] = malloc(pool->base * sizeof(BTNode));
+  if (!pool->segments[0])
+    terminate("btPoolCreate: pool can not be created");
+  pool->nbSegments = 1;
+  pool->used = 0;
+  return pool;
 }
 
-static void FreeNodesRec(BTNode *n)
+void btPoolFree(BTPool *pool)
 {
-  if (!n)
+  if (!pool)
     return;
-  FreeNodesRec(n->left);
-  FreeNodesRec(n->right);
-  free(n);
+  for (uint32_t s = 0; s < pool->nbSegments; s++)
+    free(pool->segments[s]);
+  free(pool);
 }
 
-void btFree(BTree *tree)
+static BTNode *nodeAt(BTPool *pool, uint32_t i)
 {
-  FreeNodesRec(tree->root);
-  free(tree);
+  if (i < pool->base) // cas courant: premier segment
+    return pool->segments[0] + i;
+
+  // le segment s commence a l'indice base * (2^s - 1)
+  uint64_t q = (uint64_t)i / pool->base + 1;
+  uint32_t s = 0;
+  while (q >>= 1)
+    s++;
+  uint64_t start = (uint64_t)pool->base * (((uint64_t)1 << s) - 1);
+  return pool->segments[s] + (i - start);
 }
 
-static BTNode *createNode(void *data)
+static BTNode *createNode(BTPool *pool, void *data)
 {
-  BTNode *n = malloc(sizeof(BTNode));
-  if (!n)
-    terminate("createNode: Node can not be created");
+  uint32_t i = pool->used;
+  uint64_t end = (uint64_t)pool->base * (((uint64_t)1 << pool->nbSegments) - 1);
+  if (i == BT_NONE)
+    terminate("createNode: too many nodes");
+  if (i >= end) // pool plein: nouveau segment deux fois plus grand que le précédent
+  {
+    if (pool->nbSegments == BT_MAX_SEGMENTS)
+      terminate("createNode: Node can not be created");
+    uint64_t size = (uint64_t)pool->base << pool->nbSegments;
+    pool->segments[pool->nbSegments] = malloc(size * sizeof(BTNode));
+    if (!pool->segments[pool->nbSegments])
+      terminate("createNode: Node can not be created");
+    pool->nbSegments++;
+  }
+
+  BTNode *n = nodeAt(pool, i);
+  pool->used++;
+  n->self = i;
+  n->nbLeaves = 1;
+  n->height = 0;
   n->data = data;
-  n->left = NULL;
-  n->right = NULL;
-  n->parent = NULL;
+  n->left = BT_NONE;
+  n->right = BT_NONE;
+  n->parent = BT_NONE;
   return n;
 }
 
+static BTNode *linkedNode(BTree *tree, uint32_t i) // Noeud d'indice i, NULL si absent
+{
+  return i == BT_NONE ? NULL : nodeAt(tree->pool, i);
+}
+
+static void setMetadata(BTPool *pool, BTNode *n) // Calcule nbLeaves et height de n a partir de ses fils
+{
+  if (n->left == BT_NONE && n->right == BT_NONE)
+  {
+    n->nbLeaves = 1;
+    n->height = 0;
+    return;
+  }
+
+  n->nbLeaves = 0;
+  n->height = 0;
+  if (n->left != BT_NONE)
+  {
+    BTNode *l = nodeAt(pool, n->left);
+    n->nbLeaves += l->nbLeaves;
+    n->height = l->height + 1;
+  }
+  if (n->right != BT_NONE)
+  {
+    BTNode *r = nodeAt(pool, n->right);
+    n->nbLeaves += r->nbLeaves;
+    if (r->height + 1 > n->height)
+      n->height = r->height + 1;
+  }
+}
+
+static void updateAncestors(BTree *tree, BTNode *n) // Remet a jour n et ses ancetres apres une insertion
+{
+  while (n != NULL)
+  {
+    uint32_t oldLeaves = n->nbLeaves;
+    uint32_t oldHeight = n->height;
+    setMetadata(tree->pool, n);
+    if (n->nbLeaves == oldLeaves && n->height == oldHeight)
+      return; // rien ne change plus haut
+    n = linkedNode(tree, n->parent);
+  }
+}
+
+/// Arbre ///
+
+BTree *btCreate(void)
+{
+  BTree *tree = btCreateInPool(btPoolCreate(16));
+  tree->ownsPool = 1;
+  return tree;
+}
+
+BTree *btCreateInPool(BTPool *pool)
+{
+  BTree *tree = malloc(sizeof(BTree));
+  if (!tree)
+    terminate("btCreate: tree can not be created");
+  tree->pool = pool;
+  tree->root = BT_NONE;
+  tree->size = 0;
+  tree->ownsPool = 0;
+  return tree;
+}
+
+void btFree(BTree *tree)
+{
+  // les noeuds d'un pool partagé sont libérés avec le pool
+  if (tree->ownsPool)
+    btPoolFree(tree->pool);
+  free(tree);
+}
+
 BTNode *btCreateRoot(BTree *tree, void *data)
 {
-  BTNode *root = createNode(data);
-  tree->root = root;
+  BTNode *root = createNode(tree->pool, data);
+  tree->root = root->self;
   tree->size = 1;
   return root;
 }
 
 BTNode *btInsertLeft(BTree *tree, BTNode *n, void *data)
 {
-  BTNode *nleft = createNode(data);
-  n->left = nleft;
-  nleft->parent = n;
+  BTNode *nleft = createNode(tree->pool, data);
+  n->left = nleft->self;
+  nleft->parent = n->self;
   tree->size++;
+  updateAncestors(tree, n);
   return nleft;
 }
 
 BTNode *btInsertRight(BTree *tree, BTNode *n, void *data)
 {
-  BTNode *nright = createNode(data);
-  n->right = nright;
-  nright->parent = n;
+  BTNode *nright = createNode(tree->pool, data);
+  n->right = nright->self;
+  nright->parent = n->self;
   tree->size++;
+  updateAncestors(tree, n);
   return nright;
 }
 
 BTNode *btRoot(BTree *tree)
 {
-  return tree->root;
+  return linkedNode(tree, tree->root);
 }
 
 BTNode *btLeft(BTree *tree, BTNode *n)
 {
-  (void)(tree);
-  return n->left;
+  return linkedNode(tree, n->left);
 }
 
 BTNode *btRight(BTree *tree, BTNode *n)
 {
-  (void)(tree);
-  return n->right;
+  return linkedNode(tree, n->right);
 }
 
 BTNode *btParent(BTree *tree, BTNode *n)
 {
-  (void)(tree);
-  return n->parent;
+  return linkedNode(tree, n->parent);
 }
 
 void *btGetData(BTree *tree, BTNode *n)
@@ -126,31 +252,103 @@ int btSize(BTree *tree)
 int btIsRoot(BTree *tree, BTNode *n)
 {
   (void)(tree);
-  return (n->parent == NULL);
+  return (n->parent == BT_NONE);
 }
 
 int btIsInternal(BTree *tree, BTNode *n)
 {
   (void)(tree);
-  return (n->left != NULL || n->right != NULL);
+  return (n->left != BT_NONE || n->right != BT_NONE);
 }
 
 int btIsExternal(BTree *tree, BTNode *n)
 {
   (void)(tree);
-  return (n->left == NULL && n->right == NULL);
+  return (n->left == BT_NONE && n->right == BT_NONE);
 }
 
 int btHasLeft(BTree *tree, BTNode *n)
 {
   (void)(tree);
-  return (n->left != NULL);
+  return (n->left != BT_NONE);
 }
 
 int btHasRight(BTree *tree, BTNode *n)
 {
   (void)(tree);
-  return (n->right != NULL);
+  return (n->right != BT_NONE);
+}
+
+int btNbLeaves(BTree *tree, BTNode *n)
+{
+  (void)(tree);
+  return (int)n->nbLeaves;
+}
+
+int btHeight(BTree *tree, BTNode *n)
+{
+  (void)(tree);
+  return (int)n->height;
+}
+
+int btNodeId(BTree *tree, BTNode *n)
+{
+  (void)(tree);
+  return (int)n->self;
+}
+
+// Copie les noeuds de src dans le pool dst (parcours avec une pile explicite)
+// et retourne l'indice de la copie de la racine
+static uint32_t copyInto(BTPool *dst, BTree *src)
+{
+  if (src->root == BT_NONE)
+    return BT_NONE;
+
+  // chaque entrée de la pile: noeud source et copie de son parent
+  uint32_t *stack = malloc(2 * (size_t)src->size * sizeof(uint32_t));
+  if (!stack)
+    terminate("btMergeTrees: tree can not be copied");
+
+  uint32_t newroot = BT_NONE;
+  size_t top = 0;
+  stack[top++] = src->root;
+  stack[top++] = BT_NONE;
+
+  while (top > 0)
+  {
+    uint32_t parent = stack[--top];
+    BTNode *n = nodeAt(src->pool, stack[--top]);
+    BTNode *copy = createNode(dst, n->data);
+    copy->nbLeaves = n->nbLeaves;
+    copy->height = n->height;
+
+    if (parent == BT_NONE)
+      newroot = copy->self;
+    else
+    {
+      BTNode *p = nodeAt(dst, parent);
+      copy->parent = parent;
+      if (p->left == BT_NONE)
+        p->left = copy->self;
+      else
+        p->right = copy->self;
+    }
+
+    // le fils droit est empilé en premier pour copier le gauche d'abord
+    if (n->right != BT_NONE)
+    {
+      stack[top++] = n->right;
+      stack[top++] = copy->self;
+    }
+    if (n->left != BT_NONE)
+    {
+      stack[top++] = n->left;
+      stack[top++] = copy->self;
+    }
+  }
+
+  free(stack);
+  return newroot;
 }
 
 // Les fonctions ci-dessous sont a completer
@@ -160,20 +358,34 @@ void btMapLeaves(BTree *tree, BTNode *n, void (*f)(void *data, void *fparams), v
   if (!n) // au cas ou on appelle mapleaves la ou il n'y a pas de noeud
     return;
 
-  if (btIsExternal(tree, n)) // si on est sur une feuille
-  {
-    void *data = btGetData(tree, n);
-    f(data, fparams); // on applique la fonction f sur la feuille(ses data)
-  }
+  // parcours avec une pile explicite d'indices (pas de récursion, meme pour
+  // un arbre tres profond); le sous-arbre a au plus tree->size noeuds
+  uint32_t *stack = malloc(((size_t)tree->size + 1) * sizeof(uint32_t));
+  if (!stack)
+    terminate("btMapLeaves: traversal stack can not be allocated");
+
+  size_t top = 0;
+  stack[top++] = n->self;
 
-  else // on appelle recursivement sur les enfants
+  while (top > 0)
   {
-    if (btHasLeft(tree, n))
-      btMapLeaves(tree, btLeft(tree, n), f, fparams);
+    BTNode *cur = nodeAt(tree->pool, stack[--top]);
+
+    if (btIsExternal(tree, cur)) // si on est sur une feuille
+    {
+      f(cur->data, fparams); // on applique la fonction f sur la feuille(ses data)
+      continue;
+    }
 
-    if (btHasRight(tree, n))
-      btMapLeaves(tree, btRight(tree, n), f, fparams);
+    // le droit est empilé d'abord pour traiter les feuilles de gauche a droite
+    if (btHasRight(tree, cur))
+      stack[top++] = cur->right;
+
+    if (btHasLeft(tree, cur))
+      stack[top++] = cur->left;
   }
+
+  free(stack);
 }
 
 void btMergeTrees(BTree *lefttree, BTree *righttree, void *data)
@@ -181,17 +393,71 @@ void btMergeTrees(BTree *lefttree, BTree *righttree, void *data)
   if (lefttree == NULL || righttree == NULL) // au cas ou un des arbres est NULL(n'existe pas)
     return;
 
-  BTNode *newroot = createNode(data); // creation de la nouvelle racine
-  newroot->left = lefttree->root;     // on attache l'ancien arbre gauche a la nouvelle racine
-  if (lefttree->root != NULL)         // on verifie que l'ancien arbre gauche n'est pas vide
-    lefttree->root->parent = newroot;
+  // si les arbres ne partagent pas le meme pool, l'arbre droit y est recopié
+  uint32_t rightroot = righttree->root;
+  if (righttree->pool != lefttree->pool)
+    rightroot = copyInto(lefttree->pool, righttree);
+
+  BTNode *newroot = createNode(lefttree->pool, data); // creation de la nouvelle racine
+  newroot->left = lefttree->root;                     // on attache l'ancien arbre gauche a la nouvelle racine
+  if (lefttree->root != BT_NONE)                      // on verifie que l'ancien arbre gauche n'est pas vide
+    nodeAt(lefttree->pool, lefttree->root)->parent = newroot->self;
 
-  newroot->right = righttree->root;
-  if (righttree->root != NULL)
-    righttree->root->parent = newroot;
+  newroot->right = rightroot;
+  if (rightroot != BT_NONE)
+    nodeAt(lefttree->pool, rightroot)->parent = newroot->self;
+
+  setMetadata(lefttree->pool, newroot); // feuilles et hauteur de la nouvelle racine, en O(1)
 
   lefttree->size += righttree->size + 1; // La nouvelle taille
-  lefttree->root = newroot;              // La nouvelle racine
+  lefttree->root = newroot->self;        // La nouvelle racine
+
+  btFree(righttree); // on libere la structure de l'ancien arbre droit, la structure de l'arbre gauche devient notre arbre final
+}
+
+BTree *btCreateFromMerges(BTPool *pool, int nbLeaves, const uint32_t *children, void **data)
+{
+  if (nbLeaves < 1)
+    return NULL;
+
+  uint32_t n = (uint32_t)nbLeaves;
+  uint32_t base = pool->used;
+
+  // la table est vérifiée avant de créer le moindre noeud: chaque fils doit
+  // exister et ne pas encore avoir de parent
+  unsigned char *merged = calloc(2 * (size_t)n - 1, 1);
+  if (!merged)
+    terminate("btCreateFromMerges: table can not be checked");
+  for (uint32_t m = 0; m + 1 < n; m++)
+  {
+    for (int c = 0; c < 2; c++)
+    {
+      uint32_t child = children[2 * m + c];
+      if (child >= n + m || merged[child])
+      {
+        free(merged);
+        return NULL;
+      }
+      merged[child] = 1;
+    }
+  }
+  free(merged);
+
+  BTree *tree = btCreateInPool(pool);
+  for (uint32_t i = 0; i < n; i++)
+    createNode(pool, data[i]);
+
+  for (uint32_t m = 0; m + 1 < n; m++)
+  {
+    BTNode *node = createNode(pool, data[n + m]);
+    node->left = base + children[2 * m];
+    node->right = base + children[2 * m + 1];
+    nodeAt(pool, node->left)->parent = node->self;
+    nodeAt(pool, node->right)->parent = node->self;
+    setMetadata(pool, node); // les fils sont déja complets
+  }
 
-  free(righttree); // on libere la structure de l'ancien arbre droit, la structure de l'arbre gauche devient notre arbre final
+  tree->root = base + 2 * (n - 1);
+  tree->size = (int)(2 * n - 1);
+  return tree;
 }
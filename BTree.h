@@ -1,9 +1,34 @@
 #ifndef _BTREE_H
 #define _BTREE_H
 
+#include <stdint.h>
+
 typedef struct BTNode_t BTNode;
 typedef struct BTree_t BTree;
 
+/**
+ * @brief A pool of nodes shared by several trees. Nodes are stored contiguously
+ *        and linked by 32-bit indices; they never move when the pool grows.
+ */
+typedef struct BTPool_t BTPool;
+
+/**
+ * @brief Creates a pool able to hold capacity nodes in a single contiguous block.
+ *        The pool grows if more nodes are needed.
+ *
+ * @param capacity the expected number of nodes (e.g. 2N-1 for a dendrogram over N leaves)
+ * @return BTPool* the pool
+ */
+BTPool *btPoolCreate(int capacity);
+
+/**
+ * @brief Frees the pool and all the nodes it contains, in O(1) per block. The trees
+ *        using the pool must not be used anymore (but must still be freed with btFree).
+ *
+ * @param pool the pool
+ */
+void btPoolFree(BTPool *pool);
+
 /**
  * @brief Creates a new binary tree without any node.
  *
@@ -12,7 +37,17 @@ typedef struct BTree_t BTree;
 BTree *btCreate(void);
 
 /**
- * @brief Frees the tree from memory. The data is unfreed.
+ * @brief Creates a new binary tree without any node, whose nodes will be allocated
+ *        from the pool. Trees of the same pool are merged in O(1) by btMergeTrees.
+ *
+ * @param pool the pool
+ * @return BTree* the newly created tree
+ */
+BTree *btCreateInPool(BTPool *pool);
+
+/**
+ * @brief Frees the tree from memory. The data is unfreed. The nodes of a tree
+ *        created with btCreateInPool are only released with the pool.
  *
  * @param tree
  */
@@ -146,6 +181,36 @@ int btHasLeft(BTree *tree, BTNode *n);
  */
 int btHasRight(BTree *tree, BTNode *n);
 
+/**
+ * @brief Returns the number of leaves of the subtree rooted at n, in O(1). It is
+ *        maintained by the insertions and by btMergeTrees.
+ *
+ * @param tree the tree
+ * @param n the node
+ * @return int the number of leaves below n (1 if n is a leaf)
+ */
+int btNbLeaves(BTree *tree, BTNode *n);
+
+/**
+ * @brief Returns the height of the subtree rooted at n (the number of edges on the
+ *        longest path from n to a leaf), in O(1).
+ *
+ * @param tree the tree
+ * @param n the node
+ * @return int the height of n (0 if n is a leaf)
+ */
+int btHeight(BTree *tree, BTNode *n);
+
+/**
+ * @brief Returns the identifier of node n: its index in the pool of the tree. In a
+ *        pool holding the nodes of a single tree, the identifiers are 0..btSize-1.
+ *
+ * @param tree the tree
+ * @param n the node
+ * @return int the identifier of n
+ */
+int btNodeId(BTree *tree, BTNode *n);
+
 /**
  * @brief Applies the function f to all data at leaf nodes of the subtree rooted at node n.
  *        f is applied with the node as first argument and fparams as second argument.
@@ -161,6 +226,8 @@ void btMapLeaves(BTree *tree, BTNode *n, void (*f)(void *data, void *fparams), v
  * @brief Modifies the lefttree so that it gets a new root with the data. The left successor
  *        of the new root is the previous root of lefttree (and all its tree) and its right
  *        successor is the root of righttree (and all its tree). rightree is freed after the merge.
+ *        The merge is O(1) when both trees use the same pool; otherwise the nodes of righttree
+ *        are copied into the pool of lefttree.
  *
  * @param lefttree
  * @param righttree
@@ -168,4 +235,21 @@ void btMapLeaves(BTree *tree, BTNode *n, void (*f)(void *data, void *fparams), v
  */
 void btMergeTrees(BTree *lefttree, BTree *righttree, void *data);
 
+/**
+ * @brief Builds, in the pool, the full binary tree with nbLeaves leaves described by
+ *        a merge table, in a single pass and without any allocation besides the pool.
+ *        Node i (0 <= i < nbLeaves) is a leaf, node nbLeaves + m is the m-th merge,
+ *        whose left and right successors are nodes children[2m] and children[2m + 1].
+ *        Each node must be merged once, by a later merge. The root is the last merge.
+ *        The nodes get their identifiers (see btNodeId) in that order, offset by the
+ *        number of nodes already in the pool.
+ *
+ * @param pool the pool
+ * @param nbLeaves the number of leaves (at least 1)
+ * @param children the 2(nbLeaves - 1) successors of the merges
+ * @param data the data of the 2nbLeaves - 1 nodes, leaves first
+ * @return BTree* the newly created tree, or NULL if the table is not valid
+ */
+BTree *btCreateFromMerges(BTPool *pool, int nbLeaves, const uint32_t *children, void **data);
+
 #endif
@@ -3,33 +3,46 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "Dict.h"
+#include "Arena.h"
 
-typedef struct Node_t
+// Table a adressage ouvert (Robin Hood): chaque case contient directement la
+// clé, la valeur et le hash complet de la clé. Une case est vide si key == NULL.
+typedef struct
 {
     char *key;
     void *value;
-    struct Node_t *next;
-} Node;
+    size_t hash;
+} Entry;
 
 struct Dict_t
 {
-    Node **array;
-    size_t arraySize;
+    Entry *array;
+    size_t arraySize; // toujours une puissance de 2
     size_t nbKeys;
+    Arena *arena; // si non NULL, les clés sont copiées dans l'arène
 };
 
-static unsigned int h(Dict *d, const char *key);
+#define MAX_LOAD_NUM 4 // la table grandit au dela de 4/5 de remplissage
+#define MAX_LOAD_DEN 5
+
+static size_t h(const char *key);
 static void terminate(char *m);
 
-static unsigned int h(Dict *d, const char *key)
+static size_t h(const char *key)
 {
-    unsigned long hash = 5381;
+    size_t hash = 5381;
     while (*key != '\0')
     {
-        hash = hash * 33 + *key;
+        hash = hash * 33 + (unsigned char)*key;
         key++;
     }
-    return hash % d->arraySize;
+
+    // melange les bits pour que les bits de poids faible (l'indice) dependent
+    // de toute la clé
+    hash ^= hash >> 17;
+    hash *= (size_t)0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 29;
+    return hash;
 }
 
 static void terminate(char *m)
@@ -38,32 +51,106 @@ static void terminate(char *m)
     exit(EXIT_FAILURE);
 }
 
+// Distance entre la case idéale d'un hash et la case i
+static size_t probeDistance(Dict *d, size_t hash, size_t i)
+{
+    return (i - hash) & (d->arraySize - 1);
+}
+
+// Place une entrée (clé déja copiée) sans vérifier si la clé existe
+static void placeEntry(Dict *d, Entry e)
+{
+    size_t mask = d->arraySize - 1;
+    size_t i = e.hash & mask;
+    size_t dist = 0;
+
+    while (d->array[i].key != NULL)
+    {
+        // Robin Hood: on prend la place d'une entrée plus proche de sa case idéale
+        size_t other = probeDistance(d, d->array[i].hash, i);
+        if (other < dist)
+        {
+            Entry tmp = d->array[i];
+            d->array[i] = e;
+            e = tmp;
+            dist = other;
+        }
+        i = (i + 1) & mask;
+        dist++;
+    }
+    d->array[i] = e;
+}
+
+static void grow(Dict *d) // Double la taille de la table
+{
+    Entry *old = d->array;
+    size_t oldSize = d->arraySize;
+
+    d->arraySize *= 2;
+    d->array = calloc(d->arraySize, sizeof(Entry));
+    if (d->array == NULL)
+        terminate("Dict cannot be resized");
+
+    for (size_t i = 0; i < oldSize; i++)
+    {
+        if (old[i].key != NULL)
+            placeEntry(d, old[i]);
+    }
+    free(old);
+}
+
+// Case contenant la clé, ou -1 si elle est absente
+static long findSlot(Dict *d, const char *key, size_t hash)
+{
+    size_t mask = d->arraySize - 1;
+    size_t i = hash & mask;
+    size_t dist = 0;
+
+    while (d->array[i].key != NULL && probeDistance(d, d->array[i].hash, i) >= dist)
+    {
+        // on ne compare les chaines que si les hash complets sont égaux
+        if (d->array[i].hash == hash && strcmp(d->array[i].key, key) == 0)
+            return (long)i;
+        i = (i + 1) & mask;
+        dist++;
+    }
+    return -1;
+}
+
 Dict *dictCreate(size_t m)
 {
     Dict *d = malloc(sizeof(Dict));
     if (d == NULL)
         terminate("Dict cannot be created");
 
-    d->array = calloc(m, sizeof(Node *));
+    // m est une indication du nombre de clés: la table grandit si besoin
+    size_t size = 16;
+    while (size * MAX_LOAD_NUM < m * MAX_LOAD_DEN)
+        size *= 2;
+
+    d->array = calloc(size, sizeof(Entry));
     if (d->array == NULL)
         terminate("Dict cannot be created");
 
-    d->arraySize = m;
+    d->arraySize = size;
+    d->nbKeys = 0;
+    d->arena = NULL;
+    return d;
+}
+
+Dict *dictCreateInArena(size_t m, Arena *arena)
+{
+    Dict *d = dictCreate(m);
+    d->arena = arena;
     return d;
 }
 
 void dictFree(Dict *d)
 {
-    for (size_t i = 0; i < d->arraySize; i++)
+    if (d->arena == NULL) // sinon les clés sont libérées avec l'arène
     {
-        Node *n = d->array[i];
-        while (n != NULL)
-        {
-            Node *nn = n->next;
-            free(n->key);
-            free(n);
-            n = nn;
-        }
+        for (size_t i = 0; i < d->arraySize; i++)
+            free(d->array[i].key);
     }
 
     free(d->array);
@@ -74,16 +161,12 @@ void dictFreeValues(Dict *d, void (*freeData)(void *))
 {
     for (size_t i = 0; i < d->arraySize; i++)
     {
-        Node *n = d->array[i];
-        while (n != NULL)
-        {
-            Node *nn = n->next;
-            free(n->key);
-            if (n->value != NULL)
-                freeData(n->value);
-            free(n);
-            n = nn;
-        }
+        if (d->array[i].key == NULL)
+            continue;
+        if (d->arena == NULL)
+            free(d->array[i].key);
+        if (d->array[i].value != NULL)
+            freeData(d->array[i].value);
     }
 
     free(d->array);
@@ -94,63 +177,57 @@ void dictIterate(Dict *d, void (*f)(const char *key, void *values))
 {
     for (size_t i = 0; i < d->arraySize; i++)
     {
-        Node *n = d->array[i];
-        while (n != NULL)
-        {
-            f(n->key, n->value);
-            n = n->next;
-        }
+        if (d->array[i].key != NULL)
+            f(d->array[i].key, d->array[i].value);
     }
 }
 
 void *dictSearch(Dict *d, const char *key)
 {
-    Node *p = d->array[h(d, key)];
-    while (p != NULL && strcmp(p->key, key) != 0)
-        p = p->next;
+    long i = findSlot(d, key, h(key));
 
-    if (p != NULL)
-        return p->value;
+    if (i >= 0)
+        return d->array[i].value;
     else
         return NULL;
 }
 
 bool dictContains(Dict *d, const char *key)
 {
-    Node *p = d->array[h(d, key)];
-    while (p != NULL && strcmp(p->key, key) != 0)
-        p = p->next;
-
-    return (p != NULL);
+    return findSlot(d, key, h(key)) >= 0;
 }
 
 void dictInsert(Dict *d, const char *key, void *value)
 {
-    int hashval = h(d, key);
-    Node *p = d->array[hashval];
-    while (p != NULL && strcmp(p->key, key) != 0)
-        p = p->next;
+    size_t hash = h(key);
+    long i = findSlot(d, key, hash);
 
-    if (p != NULL)
-        p->value = value;
+    if (i >= 0)
+        d->array[i].value = value;
 
     else
     {
-        Node *newNode = malloc(sizeof(Node));
-        if (!newNode)
-            terminate("New node cannot be created.");
+        if ((d->nbKeys + 1) * MAX_LOAD_DEN > d->arraySize * MAX_LOAD_NUM)
+            grow(d);
 
-        int len = strlen(key);
-        char *k = malloc((len + 1) * sizeof(char));
-        if (!k)
-            terminate("New node cannot be created.");
+        char *k;
+        if (d->arena != NULL)
+            k = arenaStrdup(d->arena, key);
+        else
+        {
+            int len = strlen(key);
+            k = malloc((len + 1) * sizeof(char));
+            if (!k)
+                terminate("New node cannot be created.");
 
-        strcpy(k, key);
+            strcpy(k, key);
+        }
 
-        newNode->key = k;
-        newNode->value = value;
-        newNode->next = d->array[hashval];
-        d->array[hashval] = newNode;
+        Entry e;
+        e.key = k;
+        e.value = value;
+        e.hash = hash;
+        placeEntry(d, e);
         d->nbKeys++;
     }
 }
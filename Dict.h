@@ -4,20 +4,36 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include "Arena.h"
+
 /**
  * @brief Represents a dictionary.
  */
 typedef struct Dict_t Dict;
 
 /**
- * @brief Creates a new dictionary.
+ * @brief Creates a new dictionary. It is an open-addressing hash table that
+ *        grows automatically when it gets full.
  *
- * @param m size of the hash table.
+ * @param m expected number of keys (the table is sized for it, but can hold more).
  *
  * @return The created dictionary.
  */
 Dict *dictCreate(size_t m);
 
+/**
+ * @brief Creates a new dictionary whose keys are copied into the arena instead of
+ *        being allocated one by one. They are released with the arena (arenaFree),
+ *        which must therefore outlive the dictionary; dictFree and dictFreeValues
+ *        then only free the table (and the values).
+ *
+ * @param m expected number of keys.
+ * @param arena the arena receiving the keys.
+ *
+ * @return The created dictionary.
+ */
+Dict *dictCreateInArena(size_t m, Arena *arena);
+
 /**
  * @brief Frees a dictionary, including all keys but not the values.
  *
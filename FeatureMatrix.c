@@ -0,0 +1,426 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "FeatureMatrix.h"
+#include "Parallel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FM_X86 1
+#include <immintrin.h>
+#endif
+
+#define FM_ALIGN 32 // alignement des lignes (un registre AVX)
+#define FM_PAD 4    // les lignes ont un multiple de 4 doubles
+
+struct FeatureMatrix_t
+{
+    void *block;   // bloc alloué (non aligné)
+    double *data;  // debut aligné de la premiere ligne
+    size_t stride; // nombre de doubles par ligne (avec le padding)
+    size_t nbRows;
+    size_t capacity;
+    int nbFeatures;
+
+    // copie centrée des lignes pour fmCondensedDistances, calculée au
+    // premier appel (centredRows lignes)
+    void *centredBlock;
+    double *centred;
+    double *sq; // |a_i|² de chaque ligne centrée
+    size_t centredRows;
+};
+
+static void terminate(char *m)
+{
+    printf("%s\n", m);
+    exit(EXIT_FAILURE);
+}
+
+/// Noyaux de distance ///
+
+// Les lignes sont completees par des zeros, on peut donc sommer sur toute la
+// longueur stride sans changer le resultat. Les trois noyaux additionnent
+// dans le meme ordre (une somme par colonne modulo 4, puis (s0 + s2) +
+// (s1 + s3)): une distance ne dépend pas du processeur.
+
+static double distScalar(const double *a, const double *b, size_t stride)
+{
+    double s[4] = {0.0, 0.0, 0.0, 0.0};
+    for (size_t f = 0; f < stride; f += 4)
+    {
+        for (int l = 0; l < 4; l++)
+        {
+            double diff = a[f + l] - b[f + l];
+            s[l] += diff * diff;
+        }
+    }
+    return sqrt((s[0] + s[2]) + (s[1] + s[3]));
+}
+
+#ifdef FM_X86
+
+__attribute__((target("sse2"))) static double distSSE2(const double *a, const double *b, size_t stride)
+{
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (size_t f = 0; f < stride; f += 4)
+    {
+        __m128d d0 = _mm_sub_pd(_mm_load_pd(a + f), _mm_load_pd(b + f));
+        __m128d d1 = _mm_sub_pd(_mm_load_pd(a + f + 2), _mm_load_pd(b + f + 2));
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(d0, d0));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(d1, d1));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return sqrt(lanes[0] + lanes[1]);
+}
+
+__attribute__((target("avx2"))) static double distAVX2(const double *a, const double *b, size_t stride)
+{
+    __m256d acc = _mm256_setzero_pd();
+    for (size_t f = 0; f < stride; f += 4)
+    {
+        __m256d d = _mm256_sub_pd(_mm256_load_pd(a + f), _mm256_load_pd(b + f));
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(d, d));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    return sqrt((lanes[0] + lanes[2]) + (lanes[1] + lanes[3]));
+}
+
+#endif
+
+static double (*distKernel)(const double *, const double *, size_t) = NULL;
+
+static void selectKernel(void) // Choix du noyau selon le processeur (une seule fois)
+{
+    if (distKernel != NULL)
+        return;
+
+    distKernel = distScalar;
+#ifdef FM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        distKernel = distAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        distKernel = distSSE2;
+#endif
+}
+
+/// Matrice ///
+
+static void reserve(FeatureMatrix *m, size_t capacity) // Agrandit le bloc pour capacity lignes
+{
+    size_t bytes = capacity * m->stride * sizeof(double);
+    void *block = malloc(bytes + FM_ALIGN);
+    if (block == NULL)
+        terminate("fmCreate: matrix can not be allocated");
+
+    double *data = (double *)(((uintptr_t)block + FM_ALIGN - 1) & ~(uintptr_t)(FM_ALIGN - 1));
+    memset(data, 0, bytes);
+    if (m->nbRows > 0)
+        memcpy(data, m->data, m->nbRows * m->stride * sizeof(double));
+
+    free(m->block);
+    m->block = block;
+    m->data = data;
+    m->capacity = capacity;
+}
+
+FeatureMatrix *fmCreate(int nbFeatures, size_t capacity)
+{
+    FeatureMatrix *m = malloc(sizeof(FeatureMatrix));
+    if (m == NULL)
+        terminate("fmCreate: matrix can not be allocated");
+
+    selectKernel();
+
+    m->nbFeatures = nbFeatures;
+    m->stride = ((size_t)nbFeatures + FM_PAD - 1) / FM_PAD * FM_PAD;
+    if (m->stride == 0)
+        m->stride = FM_PAD;
+    m->nbRows = 0;
+    m->block = NULL;
+    m->data = NULL;
+    m->centredBlock = NULL;
+    m->centred = NULL;
+    m->sq = NULL;
+    m->centredRows = 0;
+    reserve(m, capacity > 0 ? capacity : 1);
+    return m;
+}
+
+void fmFree(FeatureMatrix *m)
+{
+    if (m == NULL)
+        return;
+    free(m->block);
+    free(m->centredBlock);
+    free(m->sq);
+    free(m);
+}
+
+double *fmAddRow(FeatureMatrix *m)
+{
+    if (m->nbRows == m->capacity)
+        reserve(m, 2 * m->capacity);
+
+    return m->data + m->stride * m->nbRows++;
+}
+
+double *fmRow(const FeatureMatrix *m, size_t i)
+{
+    return m->data + m->stride * i;
+}
+
+size_t fmNbRows(const FeatureMatrix *m)
+{
+    return m->nbRows;
+}
+
+int fmNbFeatures(const FeatureMatrix *m)
+{
+    return m->nbFeatures;
+}
+
+double fmDistance(const FeatureMatrix *m, size_t i, size_t j)
+{
+    return distKernel(fmRow(m, i), fmRow(m, j), m->stride);
+}
+
+/// Distances de toutes les paires ///
+
+// Toutes les distances d'un coup, par tuiles de lignes qui tiennent dans le
+// cache: d(i, j)² = |a_i|² + |a_j|² - 2 a_i.a_j, ou les produits scalaires
+// sont calculés par blocs de 2 x 4 lignes (chaque valeur chargée sert 2 ou 4
+// fois au lieu d'une). Quand d² est petit devant |a_i|² + |a_j|², la
+// soustraction perd des chiffres: la distance est alors recalculée
+// directement, ce qui borne l'écart relatif avec fmDistance a environ 1e-10.
+// Les colonnes sont d'abord centrées (les distances ne changent pas): sans
+// cela, des données loin de zéro feraient recalculer presque toutes les
+// paires, et seuls les vrais quasi-doublons le sont. Les paires d'une
+// tranche de lignes [first, last[ sont réparties entre les threads par
+// couples de tuiles.
+
+#define FM_TILE_BYTES (128 * 1024) // taille d'une tuile: deux tuiles tiennent dans le cache L2
+#define FM_CANCEL 0x1p-20          // d² < FM_CANCEL (|a_i|² + |a_j|²): recalcul direct
+
+// Produits scalaires sommés dans le meme ordre que les noyaux de distance
+
+static double dotScalar(const double *a, const double *b, size_t stride)
+{
+    double s[4] = {0.0, 0.0, 0.0, 0.0};
+    for (size_t f = 0; f < stride; f += 4)
+        for (int l = 0; l < 4; l++)
+            s[l] += a[f + l] * b[f + l];
+    return (s[0] + s[2]) + (s[1] + s[3]);
+}
+
+static void dot2x4Scalar(const double *a0, const double *a1, const double *const *b, size_t stride,
+                         double out[8]) // out[4r + c] = a_r.b_c
+{
+    for (int c = 0; c < 4; c++)
+    {
+        out[c] = dotScalar(a0, b[c], stride);
+        out[4 + c] = dotScalar(a1, b[c], stride);
+    }
+}
+
+#ifdef FM_X86
+
+__attribute__((target("avx2"))) static void dot2x4AVX2(const double *a0, const double *a1, const double *const *b,
+                                                       size_t stride, double out[8])
+{
+    __m256d acc[8];
+    for (int k = 0; k < 8; k++)
+        acc[k] = _mm256_setzero_pd();
+
+    for (size_t f = 0; f < stride; f += 4)
+    {
+        __m256d x0 = _mm256_load_pd(a0 + f);
+        __m256d x1 = _mm256_load_pd(a1 + f);
+        for (int c = 0; c < 4; c++)
+        {
+            __m256d y = _mm256_load_pd(b[c] + f);
+            acc[c] = _mm256_add_pd(acc[c], _mm256_mul_pd(x0, y));
+            acc[4 + c] = _mm256_add_pd(acc[4 + c], _mm256_mul_pd(x1, y));
+        }
+    }
+
+    for (int k = 0; k < 8; k++)
+    {
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc[k]);
+        out[k] = (lanes[0] + lanes[2]) + (lanes[1] + lanes[3]);
+    }
+}
+
+#endif
+
+typedef struct
+{
+    const FeatureMatrix *m;
+    const double *rows; // lignes centrées (alignées, meme stride que m)
+    double *dist;       // paires des lignes [first, last[ de la matrice condensée
+    size_t offset;      // position de la paire (first, first + 1) dans la matrice complete
+    const double *sq;   // |a_i|² de chaque ligne centrée
+    size_t first;
+    size_t last;
+    size_t tile; // nombre de lignes par tuile
+    void (*dot2x4)(const double *, const double *, const double *const *, size_t, double *);
+} BulkJob;
+
+static const double *bulkRow(const BulkJob *job, size_t i) // Ligne centrée i
+{
+    return job->rows + job->m->stride * i;
+}
+
+static void storePair(BulkJob *job, size_t i, size_t j, double dot) // Distance (i < j) a partir du
+                                                                    // produit scalaire
+{
+    const FeatureMatrix *m = job->m;
+    double norms = job->sq[i] + job->sq[j];
+    double d2 = norms - 2.0 * dot;
+
+    size_t k = i * m->nbRows - i * (i + 1) / 2 + (j - i - 1) - job->offset;
+    if (d2 < FM_CANCEL * norms) // lignes proches: trop de chiffres perdus
+        job->dist[k] = distKernel(fmRow(m, i), fmRow(m, j), m->stride);
+    else
+        job->dist[k] = sqrt(d2);
+}
+
+static void tilePair(BulkJob *job, size_t i0, size_t i1, size_t j0, size_t j1) // Paires i < j des tuiles
+                                                                               // [i0, i1[ x [j0, j1[
+{
+    const FeatureMatrix *m = job->m;
+
+    for (size_t i = i0; i < i1; i += 2)
+    {
+        // premier bloc de 4 colonnes qui contient des paires i < j
+        size_t j = j0;
+        if (i + 1 > j0)
+            j = j0 + (i + 1 - j0) / 4 * 4;
+
+        if (i + 1 == i1) // ligne seule en bas de la tuile
+        {
+            for (j = j > i + 1 ? j : i + 1; j < j1; j++)
+                storePair(job, i, j, dotScalar(bulkRow(job, i), bulkRow(job, j), m->stride));
+            continue;
+        }
+
+        for (; j + 4 <= j1; j += 4)
+        {
+            const double *b[4] = {bulkRow(job, j), bulkRow(job, j + 1), bulkRow(job, j + 2),
+                                  bulkRow(job, j + 3)};
+            double dots[8];
+            job->dot2x4(bulkRow(job, i), bulkRow(job, i + 1), b, m->stride, dots);
+
+            for (int c = 0; c < 4; c++)
+            {
+                if (j + c > i)
+                    storePair(job, i, j + c, dots[c]);
+                if (j + c > i + 1)
+                    storePair(job, i + 1, j + c, dots[4 + c]);
+            }
+        }
+
+        for (; j < j1; j++) // dernieres colonnes
+        {
+            if (j > i)
+                storePair(job, i, j, dotScalar(bulkRow(job, i), bulkRow(job, j), m->stride));
+            if (j > i + 1)
+                storePair(job, i + 1, j, dotScalar(bulkRow(job, i + 1), bulkRow(job, j), m->stride));
+        }
+    }
+}
+
+static void bulkTiles(int id, int nbThreads, void *ctx) // Couples de tuiles id, id + nbThreads, ...
+{
+    BulkJob *job = ctx;
+    size_t n = job->m->nbRows;
+    size_t count = 0;
+
+    for (size_t i0 = job->first; i0 < job->last; i0 += job->tile)
+    {
+        size_t i1 = i0 + job->tile < job->last ? i0 + job->tile : job->last;
+        for (size_t j0 = i0; j0 < n; j0 += job->tile)
+        {
+            if (count++ % (size_t)nbThreads != (size_t)id)
+                continue;
+            size_t j1 = j0 + job->tile < n ? j0 + job->tile : n;
+            tilePair(job, i0, i1, j0, j1);
+        }
+    }
+}
+
+static void centre(FeatureMatrix *m) // Copie centrée des lignes et normes (si pas a jour)
+{
+    size_t n = m->nbRows;
+    size_t stride = m->stride;
+    if (m->centredRows == n && m->centred != NULL)
+        return;
+
+    free(m->centredBlock);
+    free(m->sq);
+    double *mean = calloc(stride, sizeof(double));
+    m->sq = malloc(n * sizeof(double));
+    m->centredBlock = malloc(n * stride * sizeof(double) + FM_ALIGN);
+    if (mean == NULL || m->sq == NULL || m->centredBlock == NULL)
+        terminate("fmCondensedDistances: centred rows can not be allocated");
+    m->centred = (double *)(((uintptr_t)m->centredBlock + FM_ALIGN - 1) & ~(uintptr_t)(FM_ALIGN - 1));
+
+    // moyenne de chaque colonne (0 pour le padding), retirée de chaque ligne
+    for (size_t i = 0; i < n; i++)
+        for (size_t f = 0; f < stride; f++)
+            mean[f] += fmRow(m, i)[f];
+    for (size_t f = 0; f < stride; f++)
+        mean[f] /= (double)n;
+    for (size_t i = 0; i < n; i++)
+    {
+        double *row = m->centred + stride * i;
+        for (size_t f = 0; f < stride; f++)
+            row[f] = fmRow(m, i)[f] - mean[f];
+        m->sq[i] = dotScalar(row, row, stride);
+    }
+    free(mean);
+    m->centredRows = n;
+}
+
+void fmCondensedDistances(FeatureMatrix *m, size_t first, size_t last, double *dist)
+{
+    size_t n = m->nbRows;
+    if (last > n)
+        last = n;
+    if (first >= last || n < 2)
+        return;
+
+    centre(m);
+
+    BulkJob job;
+    job.m = m;
+    job.rows = m->centred;
+    job.dist = dist;
+    job.offset = first * n - first * (first + 1) / 2;
+    job.sq = m->sq;
+    job.first = first;
+    job.last = last;
+    job.tile = FM_TILE_BYTES / (m->stride * sizeof(double)) / 4 * 4;
+    if (job.tile < 4)
+        job.tile = 4;
+    job.dot2x4 = dot2x4Scalar;
+#ifdef FM_X86
+    if (distKernel == distAVX2)
+        job.dot2x4 = dot2x4AVX2;
+#endif
+
+    // pas plus de threads que de couples de tuiles
+    size_t nbJobs = 0;
+    for (size_t i0 = first; i0 < last; i0 += job.tile)
+        nbJobs += (n - i0 + job.tile - 1) / job.tile;
+    int nbThreads = parallelNbThreads();
+    if ((size_t)nbThreads > nbJobs)
+        nbThreads = (int)nbJobs;
+    parallelRun(nbThreads, bulkTiles, &job);
+}
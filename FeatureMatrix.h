@@ -0,0 +1,97 @@
+#ifndef FEATURE_MATRIX_H
+#define FEATURE_MATRIX_H
+
+#include <stddef.h>
+
+/**
+ * @brief Represents a matrix of feature vectors, one row per object. The rows are
+ *        stored contiguously, aligned and padded with zeros so that vectorised
+ *        kernels can process them without any remainder loop.
+ */
+typedef struct FeatureMatrix_t FeatureMatrix;
+
+/**
+ * @brief Creates an empty matrix (without any row).
+ *
+ * @param nbFeatures the number of features (columns) of each row
+ * @param capacity the number of rows to reserve (the matrix grows if needed)
+ * @return FeatureMatrix* the matrix
+ */
+FeatureMatrix *fmCreate(int nbFeatures, size_t capacity);
+
+/**
+ * @brief Frees the matrix.
+ *
+ * @param m the matrix
+ */
+void fmFree(FeatureMatrix *m);
+
+/**
+ * @brief Adds a row at the end of the matrix and returns it. All its values are 0.
+ *        The pointers previously returned by fmRow or fmAddRow may be invalidated.
+ *
+ * @param m the matrix
+ * @return double* the new row (nbFeatures values)
+ */
+double *fmAddRow(FeatureMatrix *m);
+
+/**
+ * @brief Returns the row i of the matrix.
+ *
+ * @param m the matrix
+ * @param i the row number
+ * @return double* the row
+ */
+double *fmRow(const FeatureMatrix *m, size_t i);
+
+/**
+ * @brief Returns the number of rows of the matrix.
+ *
+ * @param m the matrix
+ * @return size_t the number of rows
+ */
+size_t fmNbRows(const FeatureMatrix *m);
+
+/**
+ * @brief Returns the number of features (columns) of the matrix.
+ *
+ * @param m the matrix
+ * @return int the number of features
+ */
+int fmNbFeatures(const FeatureMatrix *m);
+
+/**
+ * @brief Returns the Euclidean distance between the rows i and j. The kernel
+ *        (AVX2, SSE2 or scalar) is chosen at run time according to the CPU. The
+ *        function can be called concurrently.
+ *
+ * @param m the matrix
+ * @param i the first row
+ * @param j the second row
+ * @return double the distance
+ */
+double fmDistance(const FeatureMatrix *m, size_t i, size_t j);
+
+/**
+ * @brief Computes the Euclidean distances between the rows first <= i < last and all
+ *        the rows j > i, in the order of the condensed matrix (n rows): pair (i, j)
+ *        goes to dist[i * n - i * (i + 1) / 2 + j - i - 1 - s], where s is the
+ *        position of pair (first, first + 1). With first = 0 and last = n, dist is
+ *        the whole condensed matrix.
+ *        The rows are processed in cache-sized tiles with a vectorised kernel, using
+ *        d² = |a|² + |b|² - 2 a.b on the rows minus the column means; pairs of close
+ *        rows, for which this formula loses precision, are recomputed with
+ *        fmDistance. The distances agree with fmDistance up to a relative error of
+ *        about 1e-10. The tiles are shared between several threads (see
+ *        parallelNbThreads).
+ *        The centred copy of the matrix is made by the first call and kept for the
+ *        next ones, until rows are added: the rows must not be modified in between.
+ *
+ * @param m the matrix
+ * @param first the first row
+ * @param last the row after the last one
+ * @param dist an array receiving the pairs of the rows, filled by the function
+ */
+void fmCondensedDistances(FeatureMatrix *m, size_t first, size_t last, double *dist);
+
+#endif
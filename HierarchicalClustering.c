@@ -1,507 +1,2200 @@
 #include "HierarchicalClustering.h"
 
+#include <ctype.h>
 #include <stdio.h> // Pour exit(EXIT_FAILURE)
 #include <stdlib.h>
 #include <string.h> // Pour strdup
+#include <stdint.h>
+#include <math.h>   // Pour sqrt
 
+#include "Arena.h"
 #include "BTree.h"
-#include "Dict.h"
 #include "LinkedList.h"
+#include "MappedFile.h"
+#include "Parallel.h"
 
 struct Hclust_t
 {
     BTree *finaltree;
+    BTPool *pool; // noeuds du dendrogramme (2N-1), contigus
+    Arena *arena; // données des noeuds (noms des feuilles, distances de fusion)
+    MappedFile *file; // ou fichier chargé par hclustLoad, dont les noeuds pointent les données
+    double *branch;   // longueur de la branche de chaque noeud vers son parent, ou NULL si
+                      // c'est la différence des distances de fusion (arbre ultramétrique)
+
+    // Ordre canonique des feuilles (de gauche a droite): les feuilles de
+    // chaque sous-arbre y sont contigues, de firstLeaf[id] a
+    // firstLeaf[id] + btNbLeaves - 1, ou id est l'identifiant du noeud
+    BTNode **leaves;
+    uint32_t *firstLeaf;
 };
 
-// Strucutre servant au stockage
-typedef struct
-{
-    const char *o1; // Nom objet 1
-    const char *o2; // Nom objet 2
-    double dist;    // Distance entre les 2 objets
-} Pair_t;
+/// Parcours ///
 
-// Structure permettant de passer les nouveaux paramètres(Dict et nouveau
-// cluster) en arguments de btMapLeaves
-typedef struct
-{
-    Dict *dict;
-    BTree *new_cluster;
-} New_params;
+// Les parcours utilisent une pile explicite plutot que la récursion: un
+// dendrogramme en chaine a une profondeur de l'ordre de N et ferait déborder
+// la pile d'appels. Une pile de btSize(tree) noeuds suffit toujours.
 
-/// hclustBuildTree///
+static void terminate(char *m)
+{
+    printf("%s\n", m);
+    exit(EXIT_FAILURE);
+}
 
-static int compare_pairs(void *a, void *b) // Compare les distances des pairs A et B
+static BTNode **allocStack(BTree *tree)
 {
-    const Pair_t *Pair_A = (const Pair_t *)a;
-    const Pair_t *Pair_B = (const Pair_t *)b;
+    BTNode **stack = malloc(((size_t)btSize(tree) + 1) * sizeof(BTNode *));
+    if (stack == NULL)
+        terminate("hclust: traversal stack can not be allocated");
+    return stack;
+}
 
-    if (Pair_A->dist < Pair_B->dist)
-        return -1;
+/// hclustBuildTree///
 
-    if (Pair_A->dist > Pair_B->dist)
-        return 1;
+// Les distances entre paires sont stockées dans une matrice condensée: un seul
+// tableau contigu contenant le triangle supérieur (i < j) ligne par ligne, dans
+// le même ordre que l'ancienne liste de paires.
 
-    return 0;
+static size_t nbPairs(size_t n) // Nombre de paires (i, j) avec i < j
+{
+    return n * (n - 1) / 2;
 }
 
-static void update_dict(void *data, void *fparams) // Fonction appelée par btMapLeaves pour
-                                                   // mettre a jour le dictionnaire
+static size_t rowStart(size_t n, size_t i) // Position de la paire (i, i + 1)
 {
-    const char *object_name = (const char *)data;
-    New_params *params = (New_params *)fparams;
-
-    // Ecrase l'ancien nom de cluster par le nouveau
-    dictInsert(params->dict, object_name, params->new_cluster);
+    return i * n - i * (i + 1) / 2;
 }
 
-Hclust *hclustBuildTree(List *objects, double (*distFn)(const char *, const char *, void *), void *distFnParams)
+static void condensedPair(size_t n, size_t k, size_t *i, size_t *j) // Retrouve (i, j) a partir
+                                                                   // de la position k
 {
-    if (objects == NULL || llLength(objects) == 0)
-        return NULL;
+    double b = 2.0 * (double)n - 1.0;
+    double est = (b - sqrt(b * b - 8.0 * (double)k)) / 2.0;
+    size_t row = est > 0.0 ? (size_t)est : 0;
+
+    // corrige les erreurs d'arrondi de l'estimation
+    while (row > 0 && rowStart(n, row) > k)
+        row--;
+    while (row + 1 < n && rowStart(n, row + 1) <= k)
+        row++;
+
+    *i = row;
+    *j = row + 1 + (k - rowStart(n, row));
+}
 
-    Hclust *hc = malloc(sizeof(Hclust));
-    if (hc == NULL)
-        return NULL;
+// Compare les paires a et b: d'abord par distance, puis par position dans la
+// matrice condensée (tie[a], ou a si tie vaut NULL) pour garder exactement
+// l'ordre du tri stable de la liste
+static int pairLess(const double *dist, const size_t *tie, size_t a, size_t b)
+{
+    if (dist[a] != dist[b])
+        return dist[a] < dist[b];
 
-    size_t number_objects = llLength(objects);
-    Dict *clusters_map = dictCreate(number_objects); // Initialisation du dictionnaire qui permettra de
-                                                     // savoir à quel cluster appartient l'object actuel
-    List *all_pairs = llCreateEmpty();               // initialisation d'une liste qui initialement
-                                                     // contiendra tt les pairs d'objects et leur distance
+    if (tie != NULL)
+        return tie[a] < tie[b];
 
-    // 1. Creer les clusteur initiaux (un seul noeud) et peuplement de la carte
-    // des clusters
-    Node *p = llHead(objects);
-    while (p != NULL)
-    {
-        char *o_name = (char *)llData(p);
-        BTree *t = btCreate();
+    return a < b;
+}
 
-        char *name_cpy = malloc(strlen(o_name) + 1); // change pour strdup car non standard
-        if (name_cpy == NULL)
-            return NULL;
+static void swapIdx(size_t *x, size_t *y)
+{
+    size_t tmp = *x;
+    *x = *y;
+    *y = tmp;
+}
 
-        strcpy(name_cpy, o_name);
+static void sortPairs(size_t *order, size_t len, const double *dist, const size_t *tie) // Tri rapide des
+                                                                                        // paires selon leur distance
+{
+    while (len > 16)
+    {
+        // pivot median de trois
+        size_t mid = len / 2;
+        if (pairLess(dist, tie, order[mid], order[0]))
+            swapIdx(&order[mid], &order[0]);
+        if (pairLess(dist, tie, order[len - 1], order[0]))
+            swapIdx(&order[len - 1], &order[0]);
+        if (pairLess(dist, tie, order[len - 1], order[mid]))
+            swapIdx(&order[len - 1], &order[mid]);
+
+        size_t pivot = order[mid];
+        size_t lo = 0;
+        size_t hi = len - 1;
+        for (;;)
+        {
+            while (pairLess(dist, tie, order[lo], pivot))
+                lo++;
+            while (pairLess(dist, tie, pivot, order[hi]))
+                hi--;
+            if (lo >= hi)
+                break;
+            swapIdx(&order[lo], &order[hi]);
+            lo++;
+            hi--;
+        }
 
-        btCreateRoot(t, name_cpy); // Creation d'un nouveau noeud dans t avec une copie du nom
-        dictInsert(clusters_map, o_name, t);
-        p = llNext(p);
+        // on trie recursivement la plus petite partie et on boucle sur l'autre
+        // pour borner la pile a O(log n)
+        size_t leftLen = hi + 1;
+        if (leftLen < len - leftLen)
+        {
+            sortPairs(order, leftLen, dist, tie);
+            order += leftLen;
+            len -= leftLen;
+        }
+        else
+        {
+            sortPairs(order + leftLen, len - leftLen, dist, tie);
+            len = leftLen;
+        }
     }
 
-    // 2. Calcul des distances initiales par paires
-    p = llHead(objects);
-    while (p != NULL)
+    // tri par insertion pour les petits morceaux
+    for (size_t a = 1; a < len; a++)
     {
-        char *o1_name = (char *)llData(p);
-        Node *q = llNext(p);
-
-        while (q != NULL)
+        size_t cur = order[a];
+        size_t b = a;
+        while (b > 0 && pairLess(dist, tie, cur, order[b - 1]))
         {
-            char *o2_name = (char *)llData(q);
-            double dist = distFn(o1_name, o2_name, distFnParams);
-
-            Pair_t *pair = malloc(sizeof(Pair_t));
-            if (!pair)
-                return NULL;
-
-            pair->o1 = o1_name;
-            pair->o2 = o2_name;
-            pair->dist = dist;
-
-            llInsertLast(all_pairs, pair);
-            q = llNext(q);
+            order[b] = order[b - 1];
+            b--;
         }
-        p = llNext(p);
+        order[b] = cur;
     }
+}
 
-    // 3. Trie la liste de la plus petite à la plus grande distance entre les
-    // pairs
-    llSort(all_pairs, compare_pairs);
-
-    // 4. Fusions
-    size_t number_clusters = number_objects;
+// Matrice condensée dans le format de stockage choisi: double, float, ou
+// uint16 quantifié entre le minimum et le maximum des distances (le code c
+// vaut min + c * step). Les deux arrondis sont croissants: ils ne peuvent
+// pas inverser l'ordre de deux distances, seulement en rendre égales.
+typedef struct
+{
+    HclustStorage storage;
+    size_t n;
+    void *data;
+    double min;  // uint16 seulement
+    double step;
+} Condensed;
+
+static double cdGet(const Condensed *c, size_t k) // Distance de la paire k
+{
+    switch (c->storage)
+    {
+    case HCLUST_FLOAT:
+        return ((const float *)c->data)[k];
+    case HCLUST_UINT16:
+        return c->min + c->step * ((const uint16_t *)c->data)[k];
+    default:
+        return ((const double *)c->data)[k];
+    }
+}
 
-    while (number_clusters > 1 && llLength(all_pairs) > 0)
+static void cdSet(Condensed *c, size_t k, double v) // Range la distance de la paire k
+{
+    switch (c->storage)
     {
-        Pair_t *closest_pair = (Pair_t *)llPopFirst(all_pairs);
+    case HCLUST_FLOAT:
+        ((float *)c->data)[k] = (float)v;
+        break;
+    case HCLUST_UINT16:
+    {
+        double code = c->step > 0.0 ? (v - c->min) / c->step + 0.5 : 0.0;
+        ((uint16_t *)c->data)[k] = code < 0.0 ? 0 : code >= 65535.0 ? 65535 : (uint16_t)code;
+        break;
+    }
+    default:
+        ((double *)c->data)[k] = v;
+    }
+}
+
+// Travail partagé entre les threads pour le calcul des distances: elles sont
+// rangées dans dist (et order si non NULL) ou dans cd, au format de stockage.
+// Sans l'un ni l'autre, chaque thread garde seulement leur minimum et leur
+// maximum (dans lo[id] et hi[id])
+typedef struct
+{
+    size_t n;
+    double *dist;
+    Condensed *cd;
+    double *lo;
+    double *hi;
+    size_t *order;
+    double (*distFn)(size_t, size_t, void *);
+    void *distFnParams;
+} DistJob;
+
+static void computeDistBlock(int id, int nbThreads, void *ctx) // Calcule un bloc contigu de la
+                                                               // matrice condensée
+{
+    DistJob *job = (DistJob *)ctx;
+    size_t total = nbPairs(job->n);
+    double lo = INFINITY;
+    double hi = -INFINITY;
 
-        char *o1_name = (char *)closest_pair->o1;
-        char *o2_name = (char *)closest_pair->o2;
+    // chaque thread recoit le meme nombre de paires (a une unite pres)
+    size_t k = total / nbThreads * id + (total % nbThreads < (size_t)id ? total % nbThreads : (size_t)id);
+    size_t end = k + total / nbThreads + ((size_t)id < total % nbThreads ? 1 : 0);
 
-        BTree *t1 = (BTree *)dictSearch(clusters_map, o1_name); // Cluster de o1
-        BTree *t2 = (BTree *)dictSearch(clusters_map, o2_name); // Cluster de o2
+    size_t i = 0, j = 0;
+    if (k < end)
+        condensedPair(job->n, k, &i, &j);
 
-        if (t1 == NULL || t2 == NULL || t1 == t2)
+    while (k < end)
+    {
+        double d = job->distFn(i, j, job->distFnParams);
+        if (job->dist != NULL)
+            job->dist[k] = d;
+        else if (job->cd != NULL)
+            cdSet(job->cd, k, d);
+        else
         {
-            free(closest_pair);
-            continue;
+            lo = d < lo ? d : lo;
+            hi = d > hi ? d : hi;
         }
+        if (job->order != NULL)
+            job->order[k] = k;
+        k++;
 
-        // Fusion trouvée => t1 et t2 sont les racines de deux clusteurs diff
-        number_clusters--;
-
-        // 4a. Préparation des données pour le nouveau noeud (distance de fusion)
-        double *new_dist = malloc(sizeof(double));
-        if (!new_dist)
+        j++;
+        if (j == job->n) // passage a la ligne suivante du triangle
         {
-            free(closest_pair);
-            return NULL;
+            i++;
+            j = i + 1;
         }
-        *new_dist = closest_pair->dist;
-
-        // 4b. Mise à jour des pointeurs de clusters
-        New_params params;
-        params.dict = clusters_map;
-        params.new_cluster = t1;
-
-        btMapLeaves(t2, btRoot(t2), update_dict, &params);
-
-        // 4c. Fusion des arbres
-        btMergeTrees(t1, t2, new_dist);
-
-        free(closest_pair);
-    }
-
-    // Liberation des pairs
-    while (llLength(all_pairs) > 0)
-    {
-        Pair_t *p_to_free = (Pair_t *)llPopFirst(all_pairs);
-        free(p_to_free); // Libère la structure Pair_t
     }
-    llFree(all_pairs);
 
-    // Arbre final
-    BTree *final_tree = NULL;
-    p = llHead(objects);
-    if (p != NULL)
+    if (job->lo != NULL)
     {
-        final_tree = (BTree *)dictSearch(clusters_map, (char *)llData(p));
+        job->lo[id] = lo;
+        job->hi[id] = hi;
     }
-
-    hc->finaltree = final_tree;
-
-    dictFree(clusters_map);
-
-    return hc;
 }
 
-/// hclustFree ///
-
-static void freeNodeDataRec(BTree *tree, BTNode *n) // fct recursive pour parcourir le clust
-                                                    // et libérer la data de chaque noeud
+static int computeCondensed(DistJob *job, double *min, double *max) // Calcule toutes les paires en les
+                                                                    // répartissant entre plusieurs
+                                                                    // threads (min et max: sans stockage)
 {
-    if (n == NULL)
-        return;
+    size_t number_pairs = nbPairs(job->n);
 
-    // on libere la data du noeud
-    void *data = btGetData(tree, n);
-    if (data != NULL)
-        free(data);
+    int nbThreads = parallelNbThreads();
+    if ((size_t)nbThreads > number_pairs) // pas plus de threads que de paires
+        nbThreads = number_pairs > 0 ? (int)number_pairs : 1;
+
+    job->lo = NULL;
+    job->hi = NULL;
+    if (min != NULL)
+    {
+        job->lo = malloc(2 * (size_t)nbThreads * sizeof(double));
+        if (job->lo == NULL)
+            return 0;
+        job->hi = job->lo + nbThreads;
+    }
 
-    // on descend dans le hc récursivement
-    if (btHasLeft(tree, n))
-        freeNodeDataRec(tree, btLeft(tree, n));
+    parallelRun(nbThreads, computeDistBlock, job);
 
-    if (btHasRight(tree, n))
-        freeNodeDataRec(tree, btRight(tree, n));
+    if (min != NULL)
+    {
+        *min = INFINITY;
+        *max = -INFINITY;
+        for (int t = 0; t < nbThreads; t++)
+        {
+            *min = job->lo[t] < *min ? job->lo[t] : *min;
+            *max = job->hi[t] > *max ? job->hi[t] : *max;
+        }
+        free(job->lo);
+    }
+    return 1;
 }
 
-void hclustFree(Hclust *hc)
+// Source des distances: une fonction appelée pour chaque paire, ou une
+// fonction qui remplit les paires d'une tranche de lignes d'un coup
+typedef struct
 {
-    if (hc == NULL)
-        return;
+    double (*distFn)(size_t, size_t, void *);
+    void (*fill)(double *, size_t, size_t, size_t, void *);
+    void *ctx;
+} DistSource;
 
-    if (hc->finaltree != NULL)
+static void fillCondensed(const DistSource *src, size_t n, double *dist, size_t *order) // Matrice condensée
+                                                                                        // (et order si non NULL)
+{
+    if (src->fill == NULL)
     {
-        BTNode *root = btRoot(
-            hc->finaltree); // on récupère la racine pour donner a freeNodeDataRec
-        freeNodeDataRec(hc->finaltree, root);
-        btFree(hc->finaltree); // on libère l'arbre apres toute les datas pour
-                               // éviter les fuites mémoires sur data
+        DistJob job = {n, dist, NULL, NULL, NULL, order, src->distFn, src->ctx};
+        computeCondensed(&job, NULL, NULL);
+        return;
     }
 
-    free(hc);
+    src->fill(dist, 0, n, n, src->ctx);
+    if (order != NULL)
+        for (size_t k = 0; k < nbPairs(n); k++)
+            order[k] = k;
 }
 
-/// hclustDepth ///
+#define FILL_BLOCK_PAIRS ((size_t)1 << 22) // paires demandées a la fois a fill (32 Mo de doubles)
 
-static int depthRec(BTree *tree, BTNode *n) // fct recursive pour calculer la profondeur
+static int fillBlocks(const DistSource *src, size_t n, Condensed *cd, double *min,
+                      double *max) // Passe sur les lignes par tranches d'au plus FILL_BLOCK_PAIRS
+                                   // paires (une ligne au moins), rangées dans cd, ou dont on
+                                   // garde seulement le minimum et le maximum si cd est NULL
 {
-    if (n == NULL) // si pas de noeud
+    size_t len = nbPairs(n) < FILL_BLOCK_PAIRS ? nbPairs(n) : FILL_BLOCK_PAIRS;
+    if (len < n - 1)
+        len = n - 1;
+    double *block = malloc((len > 0 ? len : 1) * sizeof(double));
+    if (block == NULL)
         return 0;
 
-    if (btIsExternal(tree, n)) // si on est sur une feuille
-        return 0;
+    if (cd == NULL)
+    {
+        *min = INFINITY;
+        *max = -INFINITY;
+    }
+
+    size_t first = 0;
+    while (first + 1 < n)
+    {
+        size_t last = first + 1;
+        size_t pairs = n - 1 - first;
+        while (last + 1 < n && pairs + (n - 1 - last) <= len)
+        {
+            pairs += n - 1 - last;
+            last++;
+        }
 
-    int leftDepth =
-        depthRec(tree, btLeft(tree, n)); // profondeur du sous-arbre gauche
-    int rightDepth =
-        depthRec(tree, btRight(tree, n)); // profondeur du sous-arbre droit
+        src->fill(block, first, last, n, src->ctx);
+        size_t k0 = rowStart(n, first);
+        for (size_t k = 0; k < pairs; k++)
+        {
+            if (cd != NULL)
+                cdSet(cd, k0 + k, block[k]);
+            else
+            {
+                *min = block[k] < *min ? block[k] : *min;
+                *max = block[k] > *max ? block[k] : *max;
+            }
+        }
+        first = last;
+    }
 
-    return 1 + (leftDepth > rightDepth ? leftDepth : rightDepth); // on retourne la profondeur max + 1(pour le noeud courant)
+    free(block);
+    return 1;
 }
 
-int hclustDepth(Hclust *hc)
+static int cdPass(const DistSource *src, size_t n, Condensed *cd, double *min,
+                  double *max) // Calcule toutes les distances: dans cd, ou seulement leur intervalle
 {
-    if (hc == NULL || hc->finaltree == NULL) // si aucun hc ou hc vide
-        return 0;
+    if (src->fill != NULL)
+        return fillBlocks(src, n, cd, min, max);
 
-    BTNode *root = btRoot(hc->finaltree); // on récupère la racine
-    return depthRec(hc->finaltree, root); // on appelle la fct recursive avec la racine
+    DistJob job = {n, NULL, cd, NULL, NULL, NULL, src->distFn, src->ctx};
+    return computeCondensed(&job, min, max);
 }
 
-/// hclustNBLeaves ///
-
-static int nbLeavesRec(BTree *tree, BTNode *n) // fct recursive pour compter le nb de feuilles
+static int cdCreate(Condensed *c, const DistSource *src, size_t n,
+                    HclustStorage storage) // Calcule toutes les distances au format storage, sans
+                                           // copie en double de la matrice
 {
-    if (n == NULL)
+    size_t number_pairs = nbPairs(n);
+    size_t size = storage == HCLUST_FLOAT ? sizeof(float) : storage == HCLUST_UINT16 ? sizeof(uint16_t)
+                                                                                       : sizeof(double);
+
+    c->storage = storage;
+    c->n = n;
+    c->min = 0.0;
+    c->step = 0.0;
+    c->data = malloc((number_pairs > 0 ? number_pairs : 1) * size);
+    if (c->data == NULL)
         return 0;
 
-    if (btIsExternal(tree, n)) // si on est sur une feuille
+    if (storage == HCLUST_DOUBLE)
+    {
+        fillCondensed(src, n, c->data, NULL);
         return 1;
+    }
 
-    return nbLeavesRec(tree, btLeft(tree, n)) +
-           nbLeavesRec(tree, btRight(tree, n)); // somme des feuilles des sous-arbres
-}
+    // uint16: une premiere passe, sans stockage, donne l'intervalle a quantifier
+    if (storage == HCLUST_UINT16 && number_pairs > 0)
+    {
+        double max;
+        if (!cdPass(src, n, NULL, &c->min, &max))
+        {
+            free(c->data);
+            return 0;
+        }
+        c->step = (max - c->min) / 65535.0;
+    }
 
-int hclustNbLeaves(Hclust *hc)
-{
-    if (hc == NULL || hc->finaltree == NULL) // si jamais aucun hc ou arbre
+    if (!cdPass(src, n, c, NULL, NULL))
+    {
+        free(c->data);
         return 0;
+    }
+    return 1;
+}
 
-    BTNode *root = btRoot(hc->finaltree);    // on récupère la racine
-    return nbLeavesRec(hc->finaltree, root); // on appelle la fct recursive avec la racine
+static double cdDistFn(size_t i, size_t j, void *ctx) // Distance (i < j) lue dans la matrice
+{
+    Condensed *c = ctx;
+    return cdGet(c, rowStart(c->n, i) + (j - i - 1));
 }
 
-/// hclustPrintTree ///
+// Union-find sur les indices des objets: chaque cluster est représenté par
+// un objet racine, qui donne aussi l'arbre du cluster
+typedef struct
+{
+    size_t *parent; // parent de chaque objet dans la foret
+    size_t *size;   // nombre d'objets sous chaque racine
+} UnionFind;
 
-static double nodeDistance(BTree *tree, BTNode *n)
+static size_t ufFind(UnionFind *uf, size_t x) // Racine du cluster de x (avec compression de chemin)
 {
-    if (n == NULL || btIsExternal(tree, n))
-        return 0.0;
+    size_t root = x;
+    while (uf->parent[root] != root)
+        root = uf->parent[root];
 
-    return *(double *)btGetData(tree, n);
+    while (uf->parent[x] != root)
+    {
+        size_t next = uf->parent[x];
+        uf->parent[x] = root;
+        x = next;
+    }
+    return root;
 }
 
-static void printRec(FILE *out, BTree *tree, BTNode *n, double parent_dist, int isRoot)
+static size_t ufUnion(UnionFind *uf, size_t r1, size_t r2) // Fusionne deux racines (union par
+                                                            // taille) et retourne la nouvelle
 {
-    if (btIsExternal(tree, n)) // si on est sur une feuille
+    if (uf->size[r1] < uf->size[r2])
     {
-        fprintf(out, "%s",
-                (char *)btGetData(tree, n)); // on imprime le nom de l'objet
+        size_t tmp = r1;
+        r1 = r2;
+        r2 = tmp;
+    }
+    uf->parent[r2] = r1;
+    uf->size[r1] += uf->size[r2];
+    return r1;
+}
 
-        if (!isRoot) // si ce n'est pas la racine on imprime la distance au parent
-            fprintf(out, ":%f", parent_dist);
-        return;
+// Construction du dendrogramme a partir des fusions successives (i, j): les
+// clusters sont suivis par un union-find et l'arbre de chaque cluster est
+// rangé a l'indice de sa racine
+typedef struct
+{
+    size_t n;
+    BTree **trees;
+    UnionFind uf;
+    BTPool *pool; // recoit les noeuds
+    Arena *arena; // recoit les données des noeuds
+} Dendrogram;
+
+static int dendroInit(Dendrogram *d, char **names, size_t n, BTPool *pool, Arena *arena) // Un cluster (une
+                                                                                        // feuille) par objet
+{
+    d->n = n;
+    d->pool = pool;
+    d->arena = arena;
+    d->trees = malloc(n * sizeof(BTree *));
+    d->uf.parent = malloc(n * sizeof(size_t));
+    d->uf.size = malloc(n * sizeof(size_t));
+    if (d->trees == NULL || d->uf.parent == NULL || d->uf.size == NULL)
+    {
+        free(d->trees);
+        free(d->uf.parent);
+        free(d->uf.size);
+        return 0;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        BTree *t = btCreateInPool(d->pool);
+
+        char *name_cpy = arenaStrdup(d->arena, names[i]);
+        btCreateRoot(t, name_cpy); // Creation d'un nouveau noeud dans t avec une copie du nom
+        d->trees[i] = t;
+        d->uf.parent[i] = i;
+        d->uf.size[i] = 1;
     }
+    return 1;
+}
+
+static int dendroMerge(Dendrogram *d, size_t i, size_t j, double dist) // Fusionne les clusters de i
+                                                                       // et j, retourne 0 si deja ensemble
+{
+    size_t r1 = ufFind(&d->uf, i); // Cluster de o1
+    size_t r2 = ufFind(&d->uf, j); // Cluster de o2
 
-    double dist = nodeDistance(tree, n);
+    if (r1 == r2)
+        return 0;
+
+    BTree *t1 = d->trees[r1];
+    BTree *t2 = d->trees[r2];
 
-    fprintf(out, "(");
-    printRec(out, tree, btLeft(tree, n), dist, 0); // on descend dans le sous-arbre gauche
-    fprintf(out, ",");
-    printRec(out, tree, btRight(tree, n), dist, 0); // on descend dans le sous-arbre droit
-    fprintf(out, ")");
+    // Préparation des données pour le nouveau noeud (distance de fusion)
+    double *new_dist = arenaAlloc(d->arena, sizeof(double));
+    *new_dist = dist;
 
-    if (!isRoot) // si ce n'est pas la racine on imprime la distance au parent
-        fprintf(out, ":%f", parent_dist - dist);
+    // Fusion des arbres, t1 reste l'arbre du cluster fusionné
+    btMergeTrees(t1, t2, new_dist);
+
+    // Mise à jour des clusters
+    d->trees[ufUnion(&d->uf, r1, r2)] = t1;
+    return 1;
 }
 
-void hclustPrintTree(FILE *fp, Hclust *hc)
+static BTree *dendroFinish(Dendrogram *d) // Libère les structures et retourne l'arbre final
 {
-    if (hc == NULL || hc->finaltree == NULL) // si jamais aucun hc ou hc vide
-        return;
+    BTree *final_tree = d->trees[ufFind(&d->uf, 0)];
+    free(d->trees);
+    free(d->uf.parent);
+    free(d->uf.size);
+    return final_tree;
+}
 
-    BTNode *root = btRoot(hc->finaltree); // on récupère la racine
-    if (root == NULL)
-        return;
+// Liens simples en triant toutes les paires (Kruskal), en O(N²) mémoire
+static int buildSortedPairs(Dendrogram *d, const DistSource *src)
+{
+    size_t number_objects = d->n;
+    size_t number_pairs = nbPairs(number_objects);
 
-    if (btIsExternal(hc->finaltree, root))
+    double *dist = malloc((number_pairs > 0 ? number_pairs : 1) * sizeof(double));   // matrice condensée
+    size_t *order = malloc((number_pairs > 0 ? number_pairs : 1) * sizeof(size_t)); // paires triées
+    if (dist == NULL || order == NULL)
     {
-        // Si l'arbre ne contient qu'une seule feuille, on imprime simplement son
-        // nom
-        fprintf(fp, "%s;\n", (char *)btGetData(hc->finaltree, root));
-        return;
+        free(dist);
+        free(order);
+        return 0;
     }
-    printRec(fp, hc->finaltree, root, 0.0, 1); // on appelle la fct recursive avec la racine
-    fprintf(fp, ";\n");
-}
 
-/// hclustClustersDist ///
+    // Calcul des distances initiales par paires dans la matrice condensée
+    fillCondensed(src, number_objects, dist, order);
 
-static void collectLeavesRec(
-    BTree *tree, BTNode *n, List *out) // fct recursive pour faire une liste des feuilles d'un
-                                       // sous-arbre/cluster(methode plus facile qu'avec mapleaves)
-{
-    if (n == NULL)
-        return;
+    // Trie les paires de la plus petite à la plus grande distance
+    sortPairs(order, number_pairs, dist, NULL);
 
-    if (btIsExternal(tree, n)) // si on est sur une feuille
+    // Fusions
+    size_t number_clusters = number_objects;
+    for (size_t r = 0; r < number_pairs && number_clusters > 1; r++)
     {
-        llInsertLast(out, btGetData(tree, n)); // on ajoute la data de la feuille à la liste
-        return;
+        size_t i, j;
+        condensedPair(number_objects, order[r], &i, &j);
+
+        if (dendroMerge(d, i, j, dist[order[r]]))
+            number_clusters--;
     }
 
-    collectLeavesRec(tree, btLeft(tree, n), out);  // on descend dans le sous-arbre gauche
-    collectLeavesRec(tree, btRight(tree, n), out); // on descend dans le sous-arbre droit
+    free(order);
+    free(dist);
+    return 1;
 }
 
-static void clustersDistRec(BTree *tree, BTNode *n, BTNode *parent, double T, List *clusters) // T pour threshold(plus court)
+// Etat de l'algorithme de Prim: pour chaque objet hors de l'arbre couvrant, la
+// plus petite distance a l'arbre et l'objet de l'arbre qui la realise
+typedef struct
 {
-    if (n == NULL)
-        return;
+    size_t n;
+    size_t *rest;    // objets pas encore dans l'arbre
+    size_t nbRest;
+    double *best;    // plus petite distance de chaque objet a l'arbre
+    size_t *bestK;   // position dans la matrice condensée de cette paire (départage)
+    size_t *bestFrom;
+    size_t added;    // dernier objet ajouté a l'arbre
+    double (*distFn)(size_t, size_t, void *);
+    void *distFnParams;
+} PrimJob;
+
+static void primUpdateBlock(int id, int nbThreads, void *ctx) // Met a jour les distances a l'arbre
+                                                              // d'une tranche des objets restants
+{
+    PrimJob *job = (PrimJob *)ctx;
+    size_t from = job->nbRest * id / nbThreads;
+    size_t to = job->nbRest * (id + 1) / nbThreads;
+    size_t v = job->added;
 
-    if (btIsExternal(tree, n)) // si on est sur une feuille on retourne
+    for (size_t r = from; r < to; r++)
     {
-        List *new = llCreateEmpty();           // on cree une "new"list pour stocker les
-                                               // feuilles du cluster
-        llInsertLast(new, btGetData(tree, n)); // on ajoute la feuille elle-même
-        llInsertLast(clusters, new);           // on ajoute le "new"cluster a la liste des clusters
-        return;
+        size_t w = job->rest[r];
+        size_t i = v < w ? v : w;
+        size_t j = v < w ? w : v;
+
+        // meme ordre d'appel que pour la matrice condensée
+        double dist = job->distFn(i, j, job->distFnParams);
+        size_t k = rowStart(job->n, i) + (j - i - 1);
+
+        if (dist < job->best[w] || (dist == job->best[w] && k < job->bestK[w]))
+        {
+            job->best[w] = dist;
+            job->bestK[w] = k;
+            job->bestFrom[w] = v;
+        }
     }
+}
 
-    double dn = *(double *)btGetData(tree, n); // distance du noeud courant(on cast le
-                                               // retour de GetData en double)
+// Liens simples avec l'arbre couvrant minimal de Prim, en O(N) mémoire: les
+// distances sont calculées a la demande. Les paires sont ordonnées par
+// (distance, position) comme dans buildSortedPairs, ce qui rend l'arbre
+// couvrant unique et donne exactement les memes fusions.
+static int buildPrim(Dendrogram *d, double (*distFn)(size_t, size_t, void *), void *distFnParams)
+{
+    size_t n = d->n;
+    size_t m = n - 1; // nombre d'aretes de l'arbre couvrant
+
+    PrimJob job;
+    job.n = n;
+    job.distFn = distFn;
+    job.distFnParams = distFnParams;
+    job.rest = malloc(n * sizeof(size_t));
+    job.best = malloc(n * sizeof(double));
+    job.bestK = malloc(n * sizeof(size_t));
+    job.bestFrom = malloc(n * sizeof(size_t));
+    double *edgeDist = malloc((m > 0 ? m : 1) * sizeof(double));
+    size_t *edgeK = malloc((m > 0 ? m : 1) * sizeof(size_t));
+    size_t *edgeI = malloc((m > 0 ? m : 1) * sizeof(size_t));
+    size_t *edgeJ = malloc((m > 0 ? m : 1) * sizeof(size_t));
+    size_t *order = malloc((m > 0 ? m : 1) * sizeof(size_t));
+    if (job.rest == NULL || job.best == NULL || job.bestK == NULL || job.bestFrom == NULL ||
+        edgeDist == NULL || edgeK == NULL || edgeI == NULL || edgeJ == NULL || order == NULL)
+    {
+        free(job.rest);
+        free(job.best);
+        free(job.bestK);
+        free(job.bestFrom);
+        free(edgeDist);
+        free(edgeK);
+        free(edgeI);
+        free(edgeJ);
+        free(order);
+        return 0;
+    }
 
-    int parentAbove = 1; // boolean pour savoir si le parent est au dessus du
-                         // seuil T(1 = true, 0 = false)
-    if (parent != NULL)  // sinon tout l'arbre est en dessous du seuil
+    // l'objet 0 commence l'arbre, tous les autres sont a distance infinie
+    job.nbRest = m;
+    for (size_t r = 0; r < m; r++)
     {
-        double dp = *(double *)btGetData(tree, parent); // distance du parent
-        parentAbove = (dp > T);                         // on verifie si le parent est au dessus du seuil
+        job.rest[r] = r + 1;
+        job.best[r + 1] = HUGE_VAL;
+        job.bestK[r + 1] = (size_t)-1;
     }
+    job.added = 0;
 
-    // creation d'un cluster si conditions remplies///
+    // les threads sont démarrés une fois pour toutes les étapes (sans pool,
+    // chaque étape est faite par le thread appelant)
+    int maxThreads = parallelNbThreads();
+    ParallelPool *pool = maxThreads > 1 && m >= 2 * 2048 ? parallelPoolCreate(maxThreads) : NULL;
 
-    if (dn <= T && parentAbove) // verifie que distance avec noeud en dessous <
-                                // T < distance avec parent au
-                                // dessus(conditions pour former un cluster)
+    for (size_t e = 0; e < m; e++)
     {
-        List *new = llCreateEmpty();    // on cree une "new"list pour stocker les feuilles du cluster
-        collectLeavesRec(tree, n, new); // on collecte les feuilles du cluster
-        llInsertLast(clusters, new);    // on ajoute le "new"cluster a la liste des clusters
-        return;
-    }
+        // on ne fait travailler des threads que si la tranche de chacun vaut la peine
+        int nbThreads = maxThreads;
+        if (job.nbRest < (size_t)nbThreads * 2048)
+            nbThreads = (int)(job.nbRest / 2048) + 1;
+        parallelPoolRun(pool, nbThreads, primUpdateBlock, &job);
+
+        // objet restant le plus proche de l'arbre
+        size_t bestR = 0;
+        for (size_t r = 1; r < job.nbRest; r++)
+        {
+            size_t w = job.rest[r];
+            size_t b = job.rest[bestR];
+            if (job.best[w] < job.best[b] || (job.best[w] == job.best[b] && job.bestK[w] < job.bestK[b]))
+                bestR = r;
+        }
 
-    // sinon on cherche plus bas
+        size_t w = job.rest[bestR];
+        job.rest[bestR] = job.rest[--job.nbRest];
+
+        edgeI[e] = w < job.bestFrom[w] ? w : job.bestFrom[w];
+        edgeJ[e] = w < job.bestFrom[w] ? job.bestFrom[w] : w;
+        edgeDist[e] = job.best[w];
+        edgeK[e] = job.bestK[w];
+        order[e] = e;
+        job.added = w;
+    }
 
-    clustersDistRec(tree, btLeft(tree, n), n, T, clusters);
-    clustersDistRec(tree, btRight(tree, n), n, T, clusters);
+    // Les aretes de l'arbre couvrant, triées, donnent directement les fusions
+    sortPairs(order, m, edgeDist, edgeK);
+    for (size_t e = 0; e < m; e++)
+        dendroMerge(d, edgeI[order[e]], edgeJ[order[e]], edgeDist[order[e]]);
+
+    parallelPoolFree(pool);
+    free(job.rest);
+    free(job.best);
+    free(job.bestK);
+    free(job.bestFrom);
+    free(edgeDist);
+    free(edgeK);
+    free(edgeI);
+    free(edgeJ);
+    free(order);
+    return 1;
 }
 
-List *hclustGetClustersDist(Hclust *hc, double distanceThreshold)
+// Liens simples sur une matrice stockée en float ou en uint16: l'algorithme
+// de Prim y lit les distances, ce qui évite le tableau des paires triées
+// (8 octets par paire) de buildSortedPairs
+static int buildPrimStored(Dendrogram *d, const DistSource *src, HclustStorage storage)
 {
-    List *clusters = llCreateEmpty();        // liste de clusters a retourner
-    if (hc == NULL || hc->finaltree == NULL) // si jamais struct hc ou arbre dedans NULL
-        return clusters;
+    Condensed dist;
+    if (!cdCreate(&dist, src, d->n, storage))
+        return 0;
 
-    BTNode *root = btRoot(hc->finaltree);                                    // on récupère la racine
-    clustersDistRec(hc->finaltree, root, NULL, distanceThreshold, clusters); // on appelle la fct recursive avec la racine
-    return clusters;
+    int ok = buildPrim(d, cdDistFn, &dist);
+    free(dist.data);
+    return ok;
 }
 
-/// hclustGetClustersK ///
-
-static BTNode *maxDistanceNode(BTree *tree, List *nodes) // retourne le noeud interne avec la distance la
-                                                         // plus grande pour pouvoir le couper
+// Liens complet, moyen et de Ward: algorithme de la chaine des plus proches
+// voisins sur la matrice condensée, mise a jour par la formule de
+// Lance-Williams, en O(N²). Ces liens sont réductibles: deux clusters plus
+// proches voisins l'un de l'autre peuvent etre fusionnés dès qu'on les
+// trouve, puis les fusions sont triées par distance pour construire l'arbre
+static double lanceWilliams(HclustLinkage linkage, double dki, double dkj, double dij, double ni, double nj,
+                            double nk) // Distance de k au cluster i U j
 {
-    double maxDist = -1.0; // on initialise a -1 pour etre sur que toute distance
-                           // positive soit plus grande
-    BTNode *best = NULL;   // noeud avec la distance max
-
-    for (Node *p = llHead(nodes); p != NULL; p = llNext(p))
+    switch (linkage)
     {
-        BTNode *n = (BTNode *)llData(p); // on cast le data retourné par llData en BTNode*
-        if (!btIsInternal(tree, n))      // on ne considère que les noeuds internes
-            continue;
+    case HCLUST_COMPLETE:
+        return dki > dkj ? dki : dkj;
+    case HCLUST_AVERAGE:
+        return (ni * dki + nj * dkj) / (ni + nj);
+    case HCLUST_WARD:
+        return sqrt(((ni + nk) * dki * dki + (nj + nk) * dkj * dkj - nk * dij * dij) / (ni + nj + nk));
+    default:
+        return dki < dkj ? dki : dkj;
+    }
+}
 
-        double dist = *(double *)btGetData(tree, n); // on récupère la distance du noeud courant
-        if (best == NULL || dist > maxDist)          // premier noeud (-> initialise) ou distance plus
-                                                     // grande que la max actuelle
-        {
-            maxDist = dist;
-            best = n;
-        }
+static size_t condensedAt(size_t n, size_t i, size_t j) // Position de la paire (i, j), i != j
+{
+    if (i > j)
+    {
+        size_t tmp = i;
+        i = j;
+        j = tmp;
     }
-    return best;
+    return rowStart(n, i) + (j - i - 1);
 }
 
-List *hclustGetClustersK(Hclust *hc, int K)
+static int buildNNChain(Dendrogram *d, const DistSource *src, HclustLinkage linkage, HclustStorage storage)
 {
-    List *clusters = llCreateEmpty();        // liste de clusters a retourner
-    if (hc == NULL || hc->finaltree == NULL) // si jamais struct hc ou arbre dedans NULL
-        return clusters;
+    size_t n = d->n;
+    size_t number_merges = n - 1;
 
-    BTree *tree = hc->finaltree;
-    BTNode *root = btRoot(tree); // on récupère la racine
-    if (root == NULL)
-        return clusters;
+    // les liens moyen et de Ward créent de nouvelles distances, qui peuvent
+    // sortir de [min, max]: elles sont gardées en float
+    if (storage == HCLUST_UINT16 && (linkage == HCLUST_AVERAGE || linkage == HCLUST_WARD))
+        storage = HCLUST_FLOAT;
 
-    List *candidates = llCreateEmpty(); // liste des noeuds candidats a être coupés
-    llInsertLast(candidates, root);     // on commence avec la racine comme
+    Condensed dist; // matrice condensée
+    if (!cdCreate(&dist, src, n, storage))
+        return 0;
 
-    while ((int)llLength(candidates) < K)
+    size_t *active = malloc(n * sizeof(size_t));    // clusters restants, désignés par un objet
+    size_t *size = malloc(n * sizeof(size_t));      // taille du cluster de chaque objet actif
+    size_t *chain = malloc(n * sizeof(size_t));     // chaine des plus proches voisins
+    size_t *mergeA = malloc(n * sizeof(size_t));    // fusions, dans l'ordre de la chaine
+    size_t *mergeB = malloc(n * sizeof(size_t));
+    double *mergeDist = malloc(n * sizeof(double));
+    size_t *order = malloc(n * sizeof(size_t));
+    if (active == NULL || size == NULL || chain == NULL || mergeA == NULL || mergeB == NULL ||
+        mergeDist == NULL || order == NULL)
     {
-        BTNode *best = maxDistanceNode(tree, candidates); // on cherche le noeud avec la distance max
-        if (best == NULL)                                 // plus de noeud interne a couper
-            break;
+        free(dist.data);
+        free(active);
+        free(size);
+        free(chain);
+        free(mergeA);
+        free(mergeB);
+        free(mergeDist);
+        free(order);
+        return 0;
+    }
+
+    size_t nbActive = n;
+    for (size_t i = 0; i < n; i++)
+    {
+        active[i] = i;
+        size[i] = 1;
+    }
 
-        List *newCandidates = llCreateEmpty(); // nouvelle liste de candidats après la coupe
+    size_t chainLen = 0;
+    for (size_t m = 0; m < number_merges; m++)
+    {
+        if (chainLen == 0)
+            chain[chainLen++] = active[0];
 
-        while (llLength(candidates) > 0) // pour chaque noeud dans candidates
+        // on prolonge la chaine jusqu'a deux plus proches voisins réciproques
+        size_t x, y;
+        while (1)
         {
-            BTNode *cur = (BTNode *)llPopFirst(candidates); // on récupère le premier noeud
-
-            if (cur == best) // si c'est le meilleur noeud a couper
+            x = chain[chainLen - 1];
+            size_t prev = chainLen >= 2 ? chain[chainLen - 2] : n;
+
+            // plus proche voisin de x; a égalité, le précédent de la chaine
+            // (sinon la chaine pourrait boucler), puis le plus petit indice
+            y = n;
+            double best = INFINITY;
+            for (size_t a = 0; a < nbActive; a++)
             {
-                BTNode *l = btLeft(tree, cur);  // on récupère le fils gauche
-                BTNode *r = btRight(tree, cur); // on récupère le fils droit
-
-                if (l != NULL)
-                {
-                    llInsertLast(newCandidates, l); // on ajoute le fils gauche aux nouveaux candidats
-                }
-                if (r != NULL)
-                {
-                    llInsertLast(newCandidates, r); // on ajoute le fils droit aux nouveaux candidats
-                }
-                if (!l && !r) // si best est une feuille(on ne peut pas la couper)
+                size_t k = active[a];
+                if (k == x)
+                    continue;
+                double dk = cdGet(&dist, condensedAt(n, x, k));
+                if (y == n || dk < best || (dk == best && k < y))
                 {
-                    llInsertLast(newCandidates, cur); // on réajoute le noeud courant
+                    best = dk;
+                    y = k;
                 }
             }
-            else
+            if (prev < n && cdGet(&dist, condensedAt(n, x, prev)) == best)
+                y = prev;
+
+            if (y == prev)
+                break;
+            chain[chainLen++] = y;
+        }
+        chainLen -= 2;
+
+        // fusion de x dans y: le cluster garde l'indice y
+        double dxy = cdGet(&dist, condensedAt(n, x, y));
+        mergeA[m] = x;
+        mergeB[m] = y;
+        mergeDist[m] = dxy;
+        order[m] = m;
+
+        size_t nx = size[x];
+        size_t ny = size[y];
+        for (size_t a = 0; a < nbActive; a++)
+        {
+            size_t k = active[a];
+            if (k == x || k == y)
+                continue;
+            size_t ky = condensedAt(n, k, y);
+            cdSet(&dist, ky,
+                  lanceWilliams(linkage, cdGet(&dist, condensedAt(n, k, x)), cdGet(&dist, ky), dxy, (double)nx,
+                                (double)ny, (double)size[k]));
+        }
+        size[y] = nx + ny;
+
+        for (size_t a = 0; a < nbActive; a++) // x n'est plus un cluster
+        {
+            if (active[a] == x)
             {
-                llInsertLast(newCandidates, cur); // on réajoute le noeud courant
+                active[a] = active[--nbActive];
+                break;
             }
-            // on a un cluster de plus
         }
-        llFree(candidates);         // on libère l'ancienne liste de candidats
-        candidates = newCandidates; // on met a jour candidates avec la nouvelle liste
     }
 
-    // construire la liste des clusters a retourner
-    for (Node *p = llHead(candidates); p != NULL; p = llNext(p))
+    // Les fusions sont appliquées par distance croissante (dans l'ordre de la
+    // chaine a distance égale)
+    sortPairs(order, number_merges, mergeDist, NULL);
+    for (size_t r = 0; r < number_merges; r++)
+        dendroMerge(d, mergeA[order[r]], mergeB[order[r]], mergeDist[order[r]]);
+
+    free(dist.data);
+    free(active);
+    free(size);
+    free(chain);
+    free(mergeA);
+    free(mergeB);
+    free(mergeDist);
+    free(order);
+    return 1;
+}
+
+// Calcule l'ordre canonique des feuilles et la premiere feuille de chaque
+// noeud en un seul parcours préfixe: la premiere feuille d'un noeud est la
+// prochaine feuille rencontrée quand on y entre
+static void hclustIndex(Hclust *hc)
+{
+    BTree *tree = hc->finaltree;
+    BTNode *root = btRoot(tree);
+
+    hc->leaves = malloc((size_t)btNbLeaves(tree, root) * sizeof(BTNode *));
+    hc->firstLeaf = malloc((size_t)btSize(tree) * sizeof(uint32_t));
+    if (hc->leaves == NULL || hc->firstLeaf == NULL)
+        terminate("hclust: leaf index can not be allocated");
+
+    BTNode **stack = allocStack(tree);
+    uint32_t position = 0;
+    size_t top = 0;
+    stack[top++] = root;
+
+    while (top > 0)
     {
-        BTNode *n = (BTNode *)llData(p); // on cast le data retourné par llData en BTNode*
-        List *new = llCreateEmpty();     // on crée une "new"list pour stocker les
-                                         // feuilles du cluster
-        collectLeavesRec(tree, n, new);  // on collecte les feuilles du cluster
-        llInsertLast(clusters, new);     // on ajoute le "new"cluster a la liste des clusters
+        BTNode *n = stack[--top];
+        hc->firstLeaf[btNodeId(tree, n)] = position;
+
+        if (btIsExternal(tree, n))
+        {
+            hc->leaves[position++] = n;
+            continue;
+        }
+
+        stack[top++] = btRight(tree, n);
+        stack[top++] = btLeft(tree, n);
     }
 
-    llFree(candidates); // on libère la liste des candidats
-    candidates = NULL;  // on évite les fuites mémoires
-    return clusters;
+    free(stack);
 }
 
-/// hclustGetTree ///
+void hclustDefaultOptions(HclustOptions *opt)
+{
+    opt->algorithm = HCLUST_SORTED_PAIRS;
+    opt->linkage = HCLUST_SINGLE;
+    opt->storage = HCLUST_DOUBLE;
+}
 
-BTree *hclustGetTree(Hclust *hc)
+static Hclust *buildTree(List *objects, const DistSource *src, const HclustOptions *opt)
+{
+    if (objects == NULL || llLength(objects) == 0)
+        return NULL;
+
+    HclustOptions defaults;
+    if (opt == NULL)
+    {
+        hclustDefaultOptions(&defaults);
+        opt = &defaults;
+    }
+
+    Hclust *hc = malloc(sizeof(Hclust));
+    if (hc == NULL)
+        return NULL;
+
+    size_t number_objects = llLength(objects);
+
+    // Tableau des noms pour retrouver un objet a partir de son indice
+    char **names = malloc(number_objects * sizeof(char *));
+    if (names == NULL)
+    {
+        free(hc);
+        return NULL;
+    }
+
+    size_t idx = 0;
+    for (Node *p = llHead(objects); p != NULL; p = llNext(p))
+        names[idx++] = (char *)llData(p);
+
+    // 1. Creer les clusteur initiaux (un seul noeud)
+    Dendrogram d;
+    hc->pool = btPoolCreate(2 * (int)number_objects - 1); // un dendrogramme a exactement 2N-1 noeuds
+    hc->arena = arenaCreate(0);
+    int ok = dendroInit(&d, names, number_objects, hc->pool, hc->arena);
+    free(names);
+    if (!ok)
+    {
+        btPoolFree(hc->pool);
+        arenaFree(hc->arena);
+        free(hc);
+        return NULL;
+    }
+
+    // 2. Calcul des distances et fusions
+    // (Prim a besoin des distances a la demande, pas de la matrice complete)
+    if (opt->linkage != HCLUST_SINGLE)
+        ok = buildNNChain(&d, src, opt->linkage, opt->storage);
+    else if (opt->algorithm == HCLUST_LOW_MEMORY && src->distFn != NULL)
+        ok = buildPrim(&d, src->distFn, src->ctx);
+    else if (opt->storage != HCLUST_DOUBLE)
+        ok = buildPrimStored(&d, src, opt->storage);
+    else
+        ok = buildSortedPairs(&d, src);
+
+    // Arbre final
+    hc->finaltree = dendroFinish(&d);
+    hc->file = NULL;
+    hc->branch = NULL;
+    hc->leaves = NULL;
+    hc->firstLeaf = NULL;
+
+    if (!ok)
+    {
+        hclustFree(hc);
+        return NULL;
+    }
+
+    hclustIndex(hc);
+    return hc;
+}
+
+Hclust *hclustBuildTreeIdx(List *objects, double (*distFn)(size_t, size_t, void *), void *ctx,
+                           const HclustOptions *opt)
+{
+    DistSource src = {distFn, NULL, ctx};
+    return buildTree(objects, &src, opt);
+}
+
+Hclust *hclustBuildTreeMatrix(List *objects,
+                              void (*fill)(double *condensed, size_t first, size_t last, size_t n, void *ctx),
+                              void *ctx, const HclustOptions *opt)
+{
+    DistSource src = {NULL, fill, ctx};
+    return buildTree(objects, &src, opt);
+}
+
+// Adaptateur pour les fonctions de distance qui prennent des noms d'objets
+typedef struct
+{
+    char **names;
+    double (*distFn)(const char *, const char *, void *);
+    void *distFnParams;
+} NameDistParams;
+
+static double nameDistFn(size_t i, size_t j, void *ctx)
+{
+    NameDistParams *p = (NameDistParams *)ctx;
+    return p->distFn(p->names[i], p->names[j], p->distFnParams);
+}
+
+Hclust *hclustBuildTreeOpt(List *objects, double (*distFn)(const char *, const char *, void *), void *distFnParams,
+                           const HclustOptions *opt)
+{
+    if (objects == NULL || llLength(objects) == 0)
+        return NULL;
+
+    NameDistParams params;
+    params.distFn = distFn;
+    params.distFnParams = distFnParams;
+    params.names = malloc(llLength(objects) * sizeof(char *));
+    if (params.names == NULL)
+        return NULL;
+
+    size_t idx = 0;
+    for (Node *p = llHead(objects); p != NULL; p = llNext(p))
+        params.names[idx++] = (char *)llData(p);
+
+    Hclust *hc = hclustBuildTreeIdx(objects, nameDistFn, &params, opt);
+    free(params.names);
+    return hc;
+}
+
+Hclust *hclustBuildTree(List *objects, double (*distFn)(const char *, const char *, void *), void *distFnParams)
+{
+    return hclustBuildTreeOpt(objects, distFn, distFnParams, NULL);
+}
+
+Hclust *hclustBuildFromMerges(List *objects, const uint32_t *children, const double *dists, const double *branches)
+{
+    if (objects == NULL || llLength(objects) == 0)
+        return NULL;
+
+    size_t n = llLength(objects);
+    Hclust *hc = malloc(sizeof(Hclust));
+    void **nodeData = malloc((2 * n - 1) * sizeof(void *));
+    if (hc == NULL || nodeData == NULL)
+        terminate("hclustBuildFromMerges: hclust can not be allocated");
+
+    hc->pool = btPoolCreate(2 * (int)n - 1);
+    hc->arena = arenaCreate(0);
+    hc->file = NULL;
+    hc->branch = NULL;
+    hc->leaves = NULL;
+    hc->firstLeaf = NULL;
+
+    // copies des noms et des distances, comme pour hclustBuildTree
+    size_t idx = 0;
+    for (Node *p = llHead(objects); p != NULL; p = llNext(p))
+        nodeData[idx++] = arenaStrdup(hc->arena, llData(p));
+    for (size_t m = 0; m + 1 < n; m++)
+    {
+        double *dist = arenaAlloc(hc->arena, sizeof(double));
+        *dist = dists[m];
+        nodeData[n + m] = dist;
+    }
+
+    hc->finaltree = btCreateFromMerges(hc->pool, (int)n, children, nodeData);
+    free(nodeData);
+    if (hc->finaltree == NULL)
+    {
+        hclustFree(hc);
+        return NULL;
+    }
+
+    if (branches != NULL)
+    {
+        hc->branch = malloc((2 * n - 1) * sizeof(double));
+        if (hc->branch == NULL)
+            terminate("hclustBuildFromMerges: branch lengths can not be allocated");
+        memcpy(hc->branch, branches, (2 * n - 1) * sizeof(double));
+    }
+
+    hclustIndex(hc);
+    return hc;
+}
+
+/// hclustFree ///
+
+void hclustFree(Hclust *hc)
+{
+    if (hc == NULL)
+        return;
+
+    if (hc->finaltree != NULL)
+        btFree(hc->finaltree);
+
+    // noeuds, noms des feuilles et distances de fusion en O(1)
+    btPoolFree(hc->pool);
+    arenaFree(hc->arena);
+    mfClose(hc->file);
+    free(hc->branch);
+    free(hc->leaves);
+    free(hc->firstLeaf);
+    free(hc);
+}
+
+/// hclustDepth ///
+
+int hclustDepth(Hclust *hc)
+{
+    if (hc == NULL || hc->finaltree == NULL) // si aucun hc ou hc vide
+        return 0;
+
+    BTNode *root = btRoot(hc->finaltree); // on récupère la racine
+    if (root == NULL)
+        return 0;
+
+    return btHeight(hc->finaltree, root); // hauteur tenue a jour lors des fusions
+}
+
+/// hclustNBLeaves ///
+
+int hclustNbLeaves(Hclust *hc)
+{
+    if (hc == NULL || hc->finaltree == NULL) // si jamais aucun hc ou arbre
+        return 0;
+
+    BTNode *root = btRoot(hc->finaltree); // on récupère la racine
+    if (root == NULL)
+        return 0;
+
+    return btNbLeaves(hc->finaltree, root); // nombre de feuilles tenu a jour lors des fusions
+}
+
+const char *hclustObjectName(Hclust *hc, int i)
+{
+    if (hc == NULL || hc->finaltree == NULL || i < 0 || i >= hclustNbLeaves(hc))
+        return NULL;
+
+    // la feuille de l'objet i est le noeud i
+    return btGetData(hc->finaltree, hc->leaves[hc->firstLeaf[i]]);
+}
+
+/// hclustPrintTree ///
+
+static double nodeDistance(BTree *tree, BTNode *n)
+{
+    if (n == NULL || btIsExternal(tree, n))
+        return 0.0;
+
+    return *(double *)btGetData(tree, n);
+}
+
+// Actions empilées pour écrire l'arbre: entrer dans un noeud, écrire la
+// virgule entre deux fils, ou fermer un noeud interne
+enum
+{
+    PRINT_ENTER,
+    PRINT_COMMA,
+    PRINT_CLOSE
+};
+
+// Tampon de sortie: l'arbre est écrit par blocs avec fwrite plutot qu'avec un
+// fprintf par nom et par longueur de branche
+#define OUT_SIZE (1 << 16)
+
+typedef struct
+{
+    FILE *fp;
+    size_t len;
+    char buf[OUT_SIZE];
+} OutBuffer;
+
+static void outFlush(OutBuffer *out)
+{
+    fwrite(out->buf, 1, out->len, out->fp);
+    out->len = 0;
+}
+
+static void outChar(OutBuffer *out, char c)
+{
+    if (out->len == OUT_SIZE)
+        outFlush(out);
+    out->buf[out->len++] = c;
+}
+
+static void outString(OutBuffer *out, const char *s)
+{
+    size_t n = strlen(s);
+    while (n > 0)
+    {
+        if (out->len == OUT_SIZE)
+            outFlush(out);
+        size_t chunk = OUT_SIZE - out->len < n ? OUT_SIZE - out->len : n;
+        memcpy(out->buf + out->len, s, chunk);
+        out->len += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+// Puissances de dix exactes pour le formatage en virgule fixe
+static const uint64_t POW10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+                                 1000000000};
+#define FIXED_MAX_PRECISION 9
+
+static int formatFixed(char *s, double v, int precision) // Ecrit v comme "%.*f" dans s (32 octets), retourne
+                                                        // la longueur, ou 0 si c'est a printf de trancher
+{
+    if (precision > FIXED_MAX_PRECISION)
+        return 0;
+
+    // x = |v| * 10^precision arrondi a l'entier le plus proche. Le produit
+    // est exact a 2^-53 près (en relatif): si la partie fractionnaire est trop
+    // proche de 1/2, ou si x est trop grand, le résultat pourrait différer de
+    // celui de printf
+    double x = fabs(v) * (double)POW10[precision];
+    if (!(x < 4503599627370496.0)) // 2^52 (et NaN, infini)
+        return 0;
+
+    double ip = floor(x);
+    double frac = x - ip;
+    if (fabs(frac - 0.5) <= x * 0x1p-51 + 0x1p-60)
+        return 0;
+
+    uint64_t r = (uint64_t)ip + (frac > 0.5);
+    uint64_t ipart = r / POW10[precision];
+    uint64_t fpart = r % POW10[precision];
+
+    char digits[32];
+    int len = 0;
+    for (int d = 0; d < precision; d++) // décimales, de droite a gauche
+    {
+        digits[len++] = (char)('0' + fpart % 10);
+        fpart /= 10;
+    }
+    if (precision > 0)
+        digits[len++] = '.';
+    do
+    {
+        digits[len++] = (char)('0' + ipart % 10);
+        ipart /= 10;
+    } while (ipart > 0);
+    if (signbit(v)) // printf garde le signe de -0.0 et des petits négatifs
+        digits[len++] = '-';
+
+    for (int k = 0; k < len; k++)
+        s[k] = digits[len - 1 - k];
+    s[len] = '\0';
+    return len;
+}
+
+static void formatShortest(char *s, double v) // Plus courte écriture qui relit exactement v (32 octets)
+{
+    for (int digits = 15; digits <= 17; digits++)
+    {
+        snprintf(s, 32, "%.*g", digits, v);
+        if (!isfinite(v) || strtod(s, NULL) == v)
+            return;
+    }
+}
+
+static void outDouble(OutBuffer *out, double v, int precision)
+{
+    char s[32];
+    if (precision < 0)
+        formatShortest(s, v);
+    else if (formatFixed(s, v, precision) == 0)
+    {
+        outFlush(out); // cas rare: printf écrit directement, après le tampon
+        fprintf(out->fp, "%.*f", precision, v);
+        return;
+    }
+    outString(out, s);
+}
+
+static void printBranch(OutBuffer *out, Hclust *hc, BTNode *n, int precision) // ":longueur" de la branche
+                                                                             // vers le parent
+{
+    BTree *tree = hc->finaltree;
+    BTNode *parent = btParent(tree, n);
+    if (parent == NULL) // pas de branche au dessus de la racine
+        return;
+
+    outChar(out, ':');
+    if (hc->branch != NULL)
+        outDouble(out, hc->branch[btNodeId(tree, n)], precision);
+    else // distance au parent
+        outDouble(out, nodeDistance(tree, parent) - nodeDistance(tree, n), precision);
+}
+
+static void printTree(OutBuffer *out, Hclust *hc, BTNode *root, int precision)
+{
+    BTree *tree = hc->finaltree;
+    size_t capacity = 3 * ((size_t)btSize(tree) + 1);
+    BTNode **nodes = malloc(capacity * sizeof(BTNode *));
+    unsigned char *actions = malloc(capacity);
+    if (nodes == NULL || actions == NULL)
+        terminate("hclustPrintTree: traversal stack can not be allocated");
+
+    size_t top = 0;
+    nodes[top] = root;
+    actions[top++] = PRINT_ENTER;
+
+    while (top > 0)
+    {
+        top--;
+        BTNode *n = nodes[top];
+
+        if (actions[top] == PRINT_COMMA)
+        {
+            outChar(out, ',');
+            continue;
+        }
+        if (actions[top] == PRINT_CLOSE)
+        {
+            outChar(out, ')');
+            printBranch(out, hc, n, precision);
+            continue;
+        }
+
+        if (btIsExternal(tree, n)) // si on est sur une feuille
+        {
+            outString(out, btGetData(tree, n)); // on imprime le nom de l'objet
+            printBranch(out, hc, n, precision);
+            continue;
+        }
+
+        // "(" gauche "," droit ")" : empilé dans l'ordre inverse
+        outChar(out, '(');
+        nodes[top] = n;
+        actions[top++] = PRINT_CLOSE;
+        nodes[top] = btRight(tree, n);
+        actions[top++] = PRINT_ENTER;
+        nodes[top] = n;
+        actions[top++] = PRINT_COMMA;
+        nodes[top] = btLeft(tree, n);
+        actions[top++] = PRINT_ENTER;
+    }
+
+    free(nodes);
+    free(actions);
+}
+
+void hclustWriteNewick(FILE *fp, Hclust *hc, int precision)
+{
+    if (hc == NULL || hc->finaltree == NULL) // si jamais aucun hc ou hc vide
+        return;
+
+    BTNode *root = btRoot(hc->finaltree); // on récupère la racine
+    if (root == NULL)
+        return;
+
+    OutBuffer *out = malloc(sizeof(OutBuffer));
+    if (out == NULL)
+        terminate("hclustWriteNewick: output buffer can not be allocated");
+    out->fp = fp;
+    out->len = 0;
+
+    // Si l'arbre ne contient qu'une seule feuille, on imprime simplement son nom
+    if (btIsExternal(hc->finaltree, root))
+        outString(out, btGetData(hc->finaltree, root));
+    else
+        printTree(out, hc, root, precision);
+    outString(out, ";\n");
+
+    outFlush(out);
+    free(out);
+}
+
+void hclustPrintTree(FILE *fp, Hclust *hc)
+{
+    hclustWriteNewick(fp, hc, 6); // comme "%f"
+}
+
+/// hclustClustersDist ///
+
+static void collectLeaves(Hclust *hc, BTNode *n, List *out) // fait une liste des feuilles d'un
+                                                            // sous-arbre/cluster, de gauche a droite
+{
+    BTree *tree = hc->finaltree;
+
+    // les feuilles du sous-arbre sont contigues dans l'ordre canonique
+    uint32_t first = hc->firstLeaf[btNodeId(tree, n)];
+    uint32_t last = first + (uint32_t)btNbLeaves(tree, n);
+
+    for (uint32_t pos = first; pos < last; pos++)
+        llInsertLast(out, btGetData(tree, hc->leaves[pos])); // on ajoute la data de la feuille à la liste
+}
+
+// Appelle emit pour la racine de chaque cluster, de gauche a droite
+typedef void (*ClusterEmit)(Hclust *hc, BTNode *cluster, void *params);
+
+static void clustersDist(Hclust *hc, BTNode *root, double T, ClusterEmit emit, void *params) // T pour threshold(plus court)
+{
+    BTree *tree = hc->finaltree;
+    BTNode **stack = allocStack(tree);
+
+    size_t top = 0;
+    stack[top++] = root;
+
+    while (top > 0)
+    {
+        BTNode *n = stack[--top];
+
+        if (btIsExternal(tree, n)) // si on est sur une feuille
+        {
+            emit(hc, n, params); // la feuille forme un cluster a elle seule
+            continue;
+        }
+
+        double dn = *(double *)btGetData(tree, n); // distance du noeud courant(on cast le
+                                                   // retour de GetData en double)
+
+        int parentAbove = 1;               // boolean pour savoir si le parent est au dessus du
+                                           // seuil T(1 = true, 0 = false)
+        BTNode *parent = btParent(tree, n); // NULL pour la racine: tout l'arbre est en dessous du seuil
+        if (parent != NULL)
+        {
+            double dp = *(double *)btGetData(tree, parent); // distance du parent
+            parentAbove = (dp > T);                         // on verifie si le parent est au dessus du seuil
+        }
+
+        // creation d'un cluster si conditions remplies///
+
+        if (dn <= T && parentAbove) // verifie que distance avec noeud en dessous <
+                                    // T < distance avec parent au
+                                    // dessus(conditions pour former un cluster)
+        {
+            emit(hc, n, params);
+            continue;
+        }
+
+        // sinon on cherche plus bas (le gauche sera traité en premier)
+
+        stack[top++] = btRight(tree, n);
+        stack[top++] = btLeft(tree, n);
+    }
+
+    free(stack);
+}
+
+static void emitList(Hclust *hc, BTNode *cluster, void *params)
+{
+    List *new = llCreateEmpty();       // on cree une "new"list pour stocker les feuilles du cluster
+    collectLeaves(hc, cluster, new);   // on collecte les feuilles du cluster
+    llInsertLast((List *)params, new); // on ajoute le "new"cluster a la liste des clusters
+}
+
+// Etiquettes: labels[i] est le numero du cluster de l'objet i. La feuille de
+// l'objet i est le noeud d'identifiant i (les feuilles sont créées en premier)
+typedef struct
+{
+    int *labels;
+    int nbClusters;
+} LabelParams;
+
+static void emitLabels(Hclust *hc, BTNode *cluster, void *params)
+{
+    LabelParams *lp = params;
+    BTree *tree = hc->finaltree;
+
+    uint32_t first = hc->firstLeaf[btNodeId(tree, cluster)];
+    uint32_t last = first + (uint32_t)btNbLeaves(tree, cluster);
+
+    for (uint32_t pos = first; pos < last; pos++)
+        lp->labels[btNodeId(tree, hc->leaves[pos])] = lp->nbClusters;
+    lp->nbClusters++;
+}
+
+List *hclustGetClustersDist(Hclust *hc, double distanceThreshold)
+{
+    List *clusters = llCreateEmpty();        // liste de clusters a retourner
+    if (hc == NULL || hc->finaltree == NULL) // si jamais struct hc ou arbre dedans NULL
+        return clusters;
+
+    BTNode *root = btRoot(hc->finaltree); // on récupère la racine
+    if (root != NULL)
+        clustersDist(hc, root, distanceThreshold, emitList, clusters);
+    return clusters;
+}
+
+int hclustLabelsDist(Hclust *hc, double distanceThreshold, int *labels)
+{
+    if (hc == NULL || hc->finaltree == NULL || btRoot(hc->finaltree) == NULL)
+        return 0;
+
+    LabelParams lp = {labels, 0};
+    clustersDist(hc, btRoot(hc->finaltree), distanceThreshold, emitLabels, &lp);
+    return lp.nbClusters;
+}
+
+/// hclustGetClustersK ///
+
+// Tas max des noeuds internes de la frontiere, ordonnés par distance de
+// fusion décroissante puis, a distance égale, de gauche a droite (premiere
+// feuille), comme le premier maximum trouvé dans la liste des candidats
+typedef struct
+{
+    Hclust *hc;
+    BTNode **items;
+    size_t size;
+} SplitHeap;
+
+static int splitsBefore(SplitHeap *h, BTNode *a, BTNode *b) // 1 si a doit etre coupé avant b
+{
+    BTree *tree = h->hc->finaltree;
+    double da = *(double *)btGetData(tree, a);
+    double db = *(double *)btGetData(tree, b);
+    if (da != db)
+        return da > db;
+
+    return h->hc->firstLeaf[btNodeId(tree, a)] < h->hc->firstLeaf[btNodeId(tree, b)];
+}
+
+static void heapPush(SplitHeap *h, BTNode *n)
+{
+    size_t i = h->size++;
+    while (i > 0 && splitsBefore(h, n, h->items[(i - 1) / 2]))
+    {
+        h->items[i] = h->items[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    h->items[i] = n;
+}
+
+static BTNode *heapPop(SplitHeap *h)
+{
+    BTNode *top = h->items[0];
+    BTNode *last = h->items[--h->size];
+    size_t i = 0;
+
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= h->size)
+            break;
+        if (child + 1 < h->size && splitsBefore(h, h->items[child + 1], h->items[child]))
+            child++;
+        if (!splitsBefore(h, h->items[child], last))
+            break;
+        h->items[i] = h->items[child];
+        i = child;
+    }
+    if (h->size > 0)
+        h->items[i] = last;
+    return top;
+}
+
+// Frontiere de coupe: les clusters courants, chacun rangé a la position de
+// sa premiere feuille dans startAt, et les noeuds internes dans le tas
+typedef struct
+{
+    Hclust *hc;
+    SplitHeap heap;
+    BTNode **startAt; // startAt[p]: cluster dont la premiere feuille est a la position p
+    int nbLeaves;
+    int size; // nombre de clusters
+} Frontier;
+
+static void frontierAdd(Frontier *fr, BTNode *n)
+{
+    BTree *tree = fr->hc->finaltree;
+    fr->startAt[fr->hc->firstLeaf[btNodeId(tree, n)]] = n;
+    if (btIsInternal(tree, n))
+        heapPush(&fr->heap, n);
+}
+
+static void frontierInit(Frontier *fr, Hclust *hc, int maxClusters) // La frontiere commence avec la racine
+{
+    BTree *tree = hc->finaltree;
+    BTNode *root = btRoot(tree);
+
+    fr->hc = hc;
+    fr->nbLeaves = btNbLeaves(tree, root);
+    fr->size = 1;
+    fr->heap.hc = hc;
+    fr->heap.size = 0;
+    // le tas n'a jamais plus de noeuds que la frontiere
+    fr->heap.items = malloc(((size_t)maxClusters + 1) * sizeof(BTNode *));
+    fr->startAt = calloc((size_t)fr->nbLeaves, sizeof(BTNode *));
+    if (fr->startAt == NULL || fr->heap.items == NULL)
+        terminate("hclust: frontier can not be allocated");
+
+    frontierAdd(fr, root);
+}
+
+static int frontierSplit(Frontier *fr) // Coupe le noeud interne de plus grande distance, qui est
+                                       // remplacé par ses deux fils. Retourne 0 s'il n'y en a plus
+{
+    if (fr->heap.size == 0)
+        return 0;
+
+    BTree *tree = fr->hc->finaltree;
+    BTNode *best = heapPop(&fr->heap);
+    frontierAdd(fr, btLeft(tree, best));
+    frontierAdd(fr, btRight(tree, best));
+    fr->size++; // on a un cluster de plus
+    return 1;
+}
+
+static void frontierEmit(Frontier *fr, ClusterEmit emit, void *params) // Clusters de la frontiere,
+                                                                       // de gauche a droite
+{
+    BTree *tree = fr->hc->finaltree;
+
+    // les clusters de la frontiere couvrent des tranches consécutives des feuilles
+    for (int p = 0; p < fr->nbLeaves; p += btNbLeaves(tree, fr->startAt[p]))
+        emit(fr->hc, fr->startAt[p], params);
+}
+
+static List *frontierClusters(Frontier *fr) // Liste des clusters de la frontiere
+{
+    List *clusters = llCreateEmpty();
+    frontierEmit(fr, emitList, clusters);
+    return clusters;
+}
+
+static void frontierFree(Frontier *fr)
+{
+    free(fr->startAt);
+    free(fr->heap.items);
+}
+
+static void freeClusters(List *clusters)
+{
+    for (Node *p = llHead(clusters); p != NULL; p = llNext(p))
+        llFree((List *)llData(p));
+    llFree(clusters);
+}
+
+List *hclustGetClustersK(Hclust *hc, int K)
+{
+    if (hc == NULL || hc->finaltree == NULL || btRoot(hc->finaltree) == NULL) // si jamais struct hc ou arbre dedans NULL
+        return llCreateEmpty();
+
+    int nbLeaves = hclustNbLeaves(hc);
+    int nbClusters = K < 1 ? 1 : (K > nbLeaves ? nbLeaves : K); // on ne peut pas couper une feuille
+
+    Frontier fr;
+    frontierInit(&fr, hc, nbClusters);
+    while (fr.size < nbClusters && frontierSplit(&fr))
+        ;
+
+    List *clusters = frontierClusters(&fr); // liste de clusters a retourner
+    frontierFree(&fr);
+    return clusters;
+}
+
+int hclustLabelsK(Hclust *hc, int K, int *labels)
+{
+    if (hc == NULL || hc->finaltree == NULL || btRoot(hc->finaltree) == NULL)
+        return 0;
+
+    int nbLeaves = hclustNbLeaves(hc);
+    int nbClusters = K < 1 ? 1 : (K > nbLeaves ? nbLeaves : K);
+
+    Frontier fr;
+    frontierInit(&fr, hc, nbClusters);
+    while (fr.size < nbClusters && frontierSplit(&fr))
+        ;
+
+    LabelParams lp = {labels, 0};
+    frontierEmit(&fr, emitLabels, &lp);
+    frontierFree(&fr);
+    return lp.nbClusters;
+}
+
+void hclustMapClustersK(Hclust *hc, int kmin, int kmax, void (*f)(int k, List *clusters, void *fparams),
+                        void *fparams)
+{
+    if (hc == NULL || hc->finaltree == NULL || btRoot(hc->finaltree) == NULL || kmax < kmin)
+        return;
+
+    int nbLeaves = hclustNbLeaves(hc);
+    int maxClusters = kmax < 1 ? 1 : (kmax > nbLeaves ? nbLeaves : kmax);
+
+    // une seule frontiere pour tout l'intervalle: passer de k a k + 1
+    // clusters ne coute qu'une coupe
+    Frontier fr;
+    frontierInit(&fr, hc, maxClusters);
+
+    // au dela du nombre d'objets, la coupe ne change plus: ces k sont ignorés
+    for (int k = kmin; k <= maxClusters; k++)
+    {
+        while (fr.size < k && frontierSplit(&fr))
+            ;
+
+        List *clusters = frontierClusters(&fr);
+        f(k, clusters, fparams);
+        freeClusters(clusters);
+    }
+
+    frontierFree(&fr);
+}
+
+/// hclustGetTree ///
+
+BTree *hclustGetTree(Hclust *hc)
 {
     if (hc == NULL)
         return NULL;
 
     return hc->finaltree;
-}
\ No newline at end of file
+}
+
+/// hclustSave / hclustLoad ///
+
+// Format binaire (ordre des octets de la machine):
+//   "HCLUSTB\1"   8 octets
+//   uint64_t N     nombre d'objets
+//   N - 1 fusions  {uint32_t gauche, uint32_t droit, double distance}, 16 octets chacune
+//   N noms         terminés par '\0', dans l'ordre des objets
+// Les fils sont des identifiants de noeuds: i < N pour l'objet i, N + m pour
+// la m-ieme fusion. Tout est aligné sur 8 octets, si bien que les distances
+// sont utilisées en place dans le fichier mappé
+static const char HCLUST_MAGIC[8] = {'H', 'C', 'L', 'U', 'S', 'T', 'B', '\1'};
+#define HCLUST_HEADER 16
+
+typedef struct
+{
+    uint32_t left;
+    uint32_t right;
+    double dist;
+} MergeRecord;
+
+int hclustSave(Hclust *hc, const char *filename)
+{
+    if (hc == NULL || hc->finaltree == NULL || btRoot(hc->finaltree) == NULL)
+        return 0;
+
+    BTree *tree = hc->finaltree;
+    uint64_t n = (uint64_t)hclustNbLeaves(hc);
+
+    // Les noeuds ont été créés feuilles d'abord puis fusion par fusion: la
+    // fusion m est le noeud N + m, et ses fils ont des identifiants plus petits
+    MergeRecord *merges = malloc((n > 1 ? n - 1 : 1) * sizeof(MergeRecord));
+    BTNode **stack = allocStack(tree);
+    if (merges == NULL)
+        terminate("hclustSave: merge table can not be allocated");
+
+    size_t top = 0;
+    stack[top++] = btRoot(tree);
+    while (top > 0)
+    {
+        BTNode *node = stack[--top];
+        if (btIsExternal(tree, node))
+            continue;
+
+        MergeRecord *r = &merges[(uint64_t)btNodeId(tree, node) - n];
+        r->left = (uint32_t)btNodeId(tree, btLeft(tree, node));
+        r->right = (uint32_t)btNodeId(tree, btRight(tree, node));
+        r->dist = *(double *)btGetData(tree, node);
+
+        stack[top++] = btRight(tree, node);
+        stack[top++] = btLeft(tree, node);
+    }
+    free(stack);
+
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL)
+    {
+        free(merges);
+        return 0;
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    fwrite(HCLUST_MAGIC, 1, sizeof(HCLUST_MAGIC), fp);
+    fwrite(&n, sizeof(n), 1, fp);
+    fwrite(merges, sizeof(MergeRecord), (size_t)(n - 1), fp);
+    for (uint64_t i = 0; i < n; i++)
+        fwrite(hclustObjectName(hc, (int)i), 1, strlen(hclustObjectName(hc, (int)i)) + 1, fp);
+    free(merges);
+
+    int ok = !ferror(fp);
+    return fclose(fp) == 0 && ok;
+}
+
+Hclust *hclustLoad(const char *filename)
+{
+    MappedFile *mf = mfOpen(filename);
+    if (mf == NULL)
+        return NULL;
+
+    char *data = mfData(mf);
+    size_t size = mfSize(mf);
+    uint64_t n = 0;
+    if (size >= HCLUST_HEADER && memcmp(data, HCLUST_MAGIC, sizeof(HCLUST_MAGIC)) == 0)
+        memcpy(&n, data + sizeof(HCLUST_MAGIC), sizeof(n));
+    if (n < 1 || n > INT32_MAX / 2 || (size - HCLUST_HEADER) / sizeof(MergeRecord) < n - 1)
+    {
+        mfClose(mf); // ce n'est pas un dendrogramme sauvé par hclustSave
+        return NULL;
+    }
+
+    // Données des noeuds: noms et distances pointent directement dans le fichier
+    MergeRecord *merges = (MergeRecord *)(data + HCLUST_HEADER);
+    void **nodeData = malloc((2 * n - 1) * sizeof(void *));
+    uint32_t *children = malloc((n > 1 ? 2 * (n - 1) : 1) * sizeof(uint32_t));
+    if (nodeData == NULL || children == NULL)
+        terminate("hclustLoad: merge table can not be allocated");
+
+    char *name = (char *)(merges + (n - 1));
+    char *end = data + size;
+    int ok = 1;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        char *last = name < end ? memchr(name, '\0', (size_t)(end - name)) : NULL;
+        if (last == NULL) // nom tronqué
+        {
+            ok = 0;
+            break;
+        }
+        nodeData[i] = name;
+        name = last + 1;
+    }
+    for (uint64_t m = 0; m + 1 < n; m++)
+    {
+        children[2 * m] = merges[m].left;
+        children[2 * m + 1] = merges[m].right;
+        nodeData[n + m] = &merges[m].dist;
+    }
+
+    Hclust *hc = malloc(sizeof(Hclust));
+    if (hc == NULL)
+        terminate("hclustLoad: hclust can not be allocated");
+    hc->pool = btPoolCreate(2 * (int)n - 1);
+    hc->arena = NULL;
+    hc->file = mf;
+    hc->branch = NULL;
+    hc->leaves = NULL;
+    hc->firstLeaf = NULL;
+    hc->finaltree = ok ? btCreateFromMerges(hc->pool, (int)n, children, nodeData) : NULL;
+    free(nodeData);
+    free(children);
+
+    if (hc->finaltree == NULL)
+    {
+        hclustFree(hc);
+        return NULL;
+    }
+    hclustIndex(hc);
+    return hc;
+}
+
+/// hclustReadNewick ///
+
+// Lecture d'un arbre Newick en une passe et sans récursion: les noeuds lus
+// attendent sur une pile la parenthese fermante de leur parent. Les feuilles
+// sont numérotées dans l'ordre du fichier et les fusions dans l'ordre ou
+// elles se ferment (fils avant parent), comme dans hclustBuildTree. La
+// distance d'une fusion est la plus grande hauteur de ses fils augmentée de
+// leur longueur de branche. Un noeud a plus de deux fils devient une suite de
+// fusions a la meme distance; un noeud a un seul fils est ignoré (sa branche
+// s'ajoute a celle de son fils). Les longueurs lues sont aussi gardées telles
+// quelles dans hc->branch, pour réécrire un arbre non ultramétrique (neighbor
+// joining) avec ses propres longueurs.
+
+#define NEWICK_MERGE 0x80000000u // bit des références vers une fusion (sinon une feuille)
+
+typedef struct
+{
+    uint32_t ref;  // feuille i, ou NEWICK_MERGE | m pour la fusion m
+    double height; // distance de fusion du noeud (0 pour une feuille)
+    double branch; // longueur de la branche vers le parent
+} NewickItem;
+
+typedef struct
+{
+    char *p;
+    char *end;
+    Arena *arena; // noms des feuilles et distances de fusion
+    NewickItem *items; // noeuds en attente de leur parent
+    size_t nbItems, capItems;
+    size_t *groups; // début dans items de chaque parenthese ouverte
+    size_t nbGroups, capGroups;
+    char **names;
+    size_t nbNames, capNames;
+    double *leafBranch; // longueur de la branche de chaque feuille vers son parent
+    size_t capLeafBranch;
+    MergeRecord *merges;
+    size_t nbMerges, capMerges;
+    double *mergeBranch; // idem pour chaque fusion
+    size_t capMergeBranch;
+} NewickParser;
+
+static void *growArray(void *array, size_t *capacity, size_t size, size_t elemSize) // Double la capacité
+                                                                                    // si size l'atteint
+{
+    if (size < *capacity)
+        return array;
+
+    size_t bigger = *capacity > 0 ? 2 * *capacity : 64;
+    void *grown = realloc(array, bigger * elemSize);
+    if (grown == NULL)
+        terminate("hclustReadNewick: tree can not be allocated");
+    *capacity = bigger;
+    return grown;
+}
+
+static int isNewickDelimiter(char c)
+{
+    return c == '(' || c == ')' || c == ',' || c == ':' || c == ';' || c == '[' || c == '\0' ||
+           isspace((unsigned char)c);
+}
+
+static void newickSkip(NewickParser *np) // Saute les blancs et les commentaires [...]
+{
+    while (np->p < np->end)
+    {
+        if (isspace((unsigned char)*np->p))
+            np->p++;
+        else if (*np->p == '[')
+        {
+            char *close = memchr(np->p, ']', (size_t)(np->end - np->p));
+            np->p = close != NULL ? close + 1 : np->end;
+        }
+        else
+            return;
+    }
+}
+
+static char *newickLabel(NewickParser *np, int keep) // Lit un nom, éventuellement entre apostrophes,
+                                                     // et le copie dans l'arene si keep
+{
+    char *start = np->p;
+    size_t len;
+
+    if (np->p < np->end && *np->p == '\'')
+    {
+        start = ++np->p;
+        while (np->p < np->end && *np->p != '\'')
+            np->p++;
+        len = (size_t)(np->p - start);
+        if (np->p < np->end)
+            np->p++; // apostrophe fermante
+    }
+    else
+    {
+        // les espaces sont permis dans un nom (hclustPrintTree les écrit tels
+        // quels), sauf a la fin
+        while (np->p < np->end && (!isNewickDelimiter(*np->p) || *np->p == ' '))
+            np->p++;
+        len = (size_t)(np->p - start);
+        while (len > 0 && start[len - 1] == ' ')
+            len--;
+    }
+
+    if (!keep)
+        return NULL;
+    char *name = arenaAlloc(np->arena, len + 1);
+    memcpy(name, start, len);
+    name[len] = '\0';
+    return name;
+}
+
+static double newickBranch(NewickParser *np) // ":longueur" facultative, 0 si absente
+{
+    newickSkip(np);
+    if (np->p >= np->end || *np->p != ':')
+        return 0.0;
+    np->p++;
+    newickSkip(np);
+
+    // copie du nombre: le fichier mappé n'est pas terminé par '\0'
+    char number[64];
+    size_t len = 0;
+    while (np->p < np->end && len + 1 < sizeof(number) && !isNewickDelimiter(*np->p))
+        number[len++] = *np->p++;
+    number[len] = '\0';
+    return strtod(number, NULL);
+}
+
+static void newickPush(NewickParser *np, uint32_t ref, double height, double branch)
+{
+    np->items = growArray(np->items, &np->capItems, np->nbItems, sizeof(NewickItem));
+    np->items[np->nbItems].ref = ref;
+    np->items[np->nbItems].height = height;
+    np->items[np->nbItems].branch = branch;
+    np->nbItems++;
+}
+
+static int newickClose(NewickParser *np) // Remplace les fils de la parenthese fermée par leur
+                                         // parent, retourne 0 si elle est vide ou n'était pas ouverte
+{
+    if (np->nbGroups == 0)
+        return 0;
+    size_t start = np->groups[--np->nbGroups];
+    if (start == np->nbItems)
+        return 0;
+
+    NewickItem *children = &np->items[start];
+    size_t count = np->nbItems - start;
+
+    if (count == 1) // noeud ignoré: son fils prend sa place, la branche du
+                    // noeud s'ajoutera a la sienne
+    {
+        np->nbItems = start + 1;
+        return 1;
+    }
+
+    // les branches des fils sont connues: on les garde pour hc->branch
+    for (size_t c = 0; c < count; c++)
+    {
+        uint32_t r = children[c].ref;
+        if (r & NEWICK_MERGE)
+            np->mergeBranch[r & ~NEWICK_MERGE] = children[c].branch;
+        else
+            np->leafBranch[r] = children[c].branch;
+    }
+
+    double height = children[0].height + children[0].branch;
+    for (size_t c = 1; c < count; c++)
+        if (children[c].height + children[c].branch > height)
+            height = children[c].height + children[c].branch;
+
+    uint32_t ref = children[0].ref;
+    for (size_t c = 1; c < count; c++)
+    {
+        np->merges = growArray(np->merges, &np->capMerges, np->nbMerges, sizeof(MergeRecord));
+        np->merges[np->nbMerges].left = ref;
+        np->merges[np->nbMerges].right = children[c].ref;
+        np->merges[np->nbMerges].dist = height;
+        np->mergeBranch = growArray(np->mergeBranch, &np->capMergeBranch, np->nbMerges, sizeof(double));
+        np->mergeBranch[np->nbMerges] = 0.0; // fusions intermédiaires d'un noeud a plus de deux fils
+        ref = NEWICK_MERGE | (uint32_t)np->nbMerges++;
+    }
+
+    np->nbItems = start;
+    newickPush(np, ref, height, 0.0);
+    return 1;
+}
+
+static int newickParse(NewickParser *np) // Lit le premier arbre, retourne 0 s'il est mal formé
+{
+    int expectNode = 1; // au début, après '(' et après ','
+
+    while (1)
+    {
+        newickSkip(np);
+        if (np->p >= np->end)
+            break; // le ';' final est facultatif
+
+        char c = *np->p;
+        if (expectNode)
+        {
+            if (c == '(')
+            {
+                np->groups = growArray(np->groups, &np->capGroups, np->nbGroups, sizeof(size_t));
+                np->groups[np->nbGroups++] = np->nbItems;
+                np->p++;
+                continue;
+            }
+            if (np->nbNames >= NEWICK_MERGE)
+                return 0;
+
+            // une feuille (dont le nom peut etre vide)
+            np->names = growArray(np->names, &np->capNames, np->nbNames, sizeof(char *));
+            np->names[np->nbNames] = newickLabel(np, 1);
+            np->leafBranch = growArray(np->leafBranch, &np->capLeafBranch, np->nbNames, sizeof(double));
+            np->leafBranch[np->nbNames] = 0.0;
+            newickPush(np, (uint32_t)np->nbNames++, 0.0, newickBranch(np));
+            expectNode = 0;
+        }
+        else if (c == ',' && np->nbGroups > 0)
+        {
+            np->p++;
+            expectNode = 1;
+        }
+        else if (c == ')')
+        {
+            np->p++;
+            if (!newickClose(np))
+                return 0;
+            newickLabel(np, 0); // les noms des noeuds internes sont ignorés
+            np->items[np->nbItems - 1].branch += newickBranch(np);
+        }
+        else if (c == ';')
+        {
+            np->p++;
+            break;
+        }
+        else
+            return 0;
+    }
+
+    return !expectNode && np->nbGroups == 0 && np->nbItems == 1;
+}
+
+Hclust *hclustReadNewick(const char *filename)
+{
+    MappedFile *mf = mfOpen(filename);
+    if (mf == NULL)
+        return NULL;
+
+    NewickParser np;
+    memset(&np, 0, sizeof(np));
+    np.p = mfData(mf);
+    np.end = np.p + mfSize(mf);
+    np.arena = arenaCreate(0);
+
+    int ok = np.p != NULL && newickParse(&np);
+    mfClose(mf); // les noms ont été copiés dans l'arene
+    free(np.items);
+    free(np.groups);
+
+    Hclust *hc = NULL;
+    size_t n = np.nbNames;
+    if (ok)
+    {
+        // Feuilles 0..N-1 puis fusions N..2N-2, comme pour hclustLoad
+        void **nodeData = malloc((2 * n - 1) * sizeof(void *));
+        uint32_t *children = malloc((n > 1 ? 2 * (n - 1) : 1) * sizeof(uint32_t));
+        double *dists = arenaAlloc(np.arena, (n > 1 ? n - 1 : 1) * sizeof(double));
+        double *branch = malloc((2 * n - 1) * sizeof(double));
+        hc = malloc(sizeof(Hclust));
+        if (nodeData == NULL || children == NULL || branch == NULL || hc == NULL)
+            terminate("hclustReadNewick: tree can not be allocated");
+
+        for (size_t i = 0; i < n; i++)
+        {
+            nodeData[i] = np.names[i];
+            branch[i] = np.leafBranch[i];
+        }
+        for (size_t m = 0; m < np.nbMerges; m++)
+        {
+            uint32_t l = np.merges[m].left, r = np.merges[m].right;
+            children[2 * m] = l & NEWICK_MERGE ? (uint32_t)n + (l & ~NEWICK_MERGE) : l;
+            children[2 * m + 1] = r & NEWICK_MERGE ? (uint32_t)n + (r & ~NEWICK_MERGE) : r;
+            dists[m] = np.merges[m].dist;
+            branch[n + m] = np.mergeBranch[m];
+            nodeData[n + m] = &dists[m];
+        }
+
+        hc->pool = btPoolCreate(2 * (int)n - 1);
+        hc->arena = np.arena;
+        hc->file = NULL;
+        hc->branch = branch; // longueurs lues, réécrites par hclustPrintTree
+        hc->leaves = NULL;
+        hc->firstLeaf = NULL;
+        hc->finaltree = btCreateFromMerges(hc->pool, (int)n, children, nodeData);
+        free(nodeData);
+        free(children);
+
+        if (hc->finaltree == NULL) // table de fusions refusée (libère aussi l'arene)
+        {
+            hclustFree(hc);
+            hc = NULL;
+        }
+        else
+            hclustIndex(hc);
+    }
+    else
+        arenaFree(np.arena);
+
+    free(np.names);
+    free(np.leafBranch);
+    free(np.merges);
+    free(np.mergeBranch);
+    return hc;
+}
@@ -10,6 +10,10 @@ typedef struct Hclust_t Hclust;
  * @brief Builds a hierarchical clustering. objects is a list of object names (char *).
  *        distFn is a function computing the distance between two objects. The names of
  *        objects are copied when stored into the structure and can be freed by the caller.
+ *        The pairwise distances are computed by several threads (see parallelNbThreads:
+ *        environment variable HCLUST_THREADS, all cores by default), so distFn may be
+ *        called concurrently and must not modify shared state. The result does not
+ *        depend on the number of threads.
  *
  * @param objects the list of object names (char *)
  * @param distFn a function computing the distance between two objects
@@ -18,6 +22,137 @@ typedef struct Hclust_t Hclust;
  */
 Hclust *hclustBuildTree(List *objects, double (*distFn)(const char *, const char *, void *), void *distFnParams);
 
+/**
+ * @brief The algorithms available to build the (single linkage) dendrogram.
+ */
+typedef enum
+{
+    HCLUST_SORTED_PAIRS, // all pairwise distances are stored and sorted: O(N²) memory
+    HCLUST_LOW_MEMORY    // Prim's minimum spanning tree with distances computed on
+                         // demand: O(N²) time but only O(N) memory
+} HclustAlgorithm;
+
+/**
+ * @brief The distance between two clusters, computed from the distances between
+ *        their objects.
+ */
+typedef enum
+{
+    HCLUST_SINGLE,   // smallest distance (the default)
+    HCLUST_COMPLETE, // largest distance
+    HCLUST_AVERAGE,  // average distance (UPGMA)
+    HCLUST_WARD      // increase of the within-cluster variance (for Euclidean distances)
+} HclustLinkage;
+
+/**
+ * @brief How the pairwise distances are stored while the tree is built. Both
+ *        roundings are monotone: they never reverse the order of two distances,
+ *        but distances closer than the rounding error may become equal, and are
+ *        then merged in index order. The merge heights are the stored values,
+ *        converted back to doubles, so they carry the same error.
+ *        The sizes below are the peak memory per pair: the distances are rounded
+ *        as they are computed, without a full-precision copy of the matrix.
+ */
+typedef enum
+{
+    HCLUST_DOUBLE, // 8 bytes per pair, exact (the default); single linkage also
+                   // sorts the pairs, 8 more bytes per pair
+    HCLUST_FLOAT,  // 4 bytes per pair, relative error at most 2^-24
+    HCLUST_UINT16  // 2 bytes per pair, quantised between the smallest and largest
+                   // distance: error at most (max - min) / 131070. The distances are
+                   // computed twice (the first pass finds min and max). Single and
+                   // complete linkage only: average and Ward linkage create distances
+                   // outside [min, max] and use HCLUST_FLOAT (4 bytes per pair)
+} HclustStorage;
+
+/**
+ * @brief Options of hclustBuildTreeOpt.
+ */
+typedef struct
+{
+    HclustAlgorithm algorithm; // used by single linkage only
+    HclustLinkage linkage;     // other linkages use the nearest-neighbour chain algorithm:
+                               // O(N²) time and O(N²) memory
+    HclustStorage storage;     // matrix of the sorted pairs and nearest-neighbour chain
+                               // algorithms. With float or uint16, single linkage runs
+                               // Prim's algorithm on the stored matrix, which needs no
+                               // sorted pair array. Average and Ward linkages round their
+                               // updated distances again at each merge
+} HclustOptions;
+
+/**
+ * @brief Fills opt with the default options (the ones used by hclustBuildTree).
+ *
+ * @param opt the options to initialise
+ */
+void hclustDefaultOptions(HclustOptions *opt);
+
+/**
+ * @brief Same as hclustBuildTree, with options. Both algorithms produce exactly the
+ *        same single linkage dendrogram, ties included. The complete, average and Ward
+ *        linkages update the distances between clusters with the Lance-Williams formula;
+ *        the distance stored at each interior node is the linkage distance of the merge.
+ *
+ * @param objects the list of object names (char *)
+ * @param distFn a function computing the distance between two objects
+ * @param distFnParams a parameter of the distance function
+ * @param opt the options, or NULL for the default ones
+ * @return Hclust* the hierarchical clustering
+ */
+Hclust *hclustBuildTreeOpt(List *objects, double (*distFn)(const char *, const char *, void *), void *distFnParams,
+                           const HclustOptions *opt);
+
+/**
+ * @brief Same as hclustBuildTreeOpt, but distFn receives the positions i < j of the
+ *        two objects in the list objects (starting at 0) instead of their names, so
+ *        that the caller can index its data directly. ctx is given as last argument
+ *        to distFn.
+ *
+ * @param objects the list of object names (char *)
+ * @param distFn a function computing the distance between the objects i and j
+ * @param ctx the last argument of the distance function
+ * @param opt the options, or NULL for the default ones
+ * @return Hclust* the hierarchical clustering
+ */
+Hclust *hclustBuildTreeIdx(List *objects, double (*distFn)(size_t i, size_t j, void *ctx), void *ctx,
+                           const HclustOptions *opt);
+
+/**
+ * @brief Same as hclustBuildTreeIdx, but the distances are computed by blocks of rows
+ *        by fill, e.g. with a blocked algorithm. fill(condensed, first, last, n, ctx)
+ *        must store the distances between the objects first <= i < last and j > i in
+ *        the order of the upper triangle of the distance matrix, row by row, starting
+ *        at condensed[0]. With double storage, fill is called once for all the rows;
+ *        with float or uint16 storage, the rows are computed by blocks of a few million
+ *        pairs, converted, and uint16 storage calls fill twice for each block (the first
+ *        pass finds the range of the distances). The whole matrix is needed, so the
+ *        HCLUST_LOW_MEMORY algorithm is not available.
+ *
+ * @param objects the list of object names (char *)
+ * @param fill a function computing the distances of rows [first, last[ of the n objects
+ * @param ctx the last argument of fill
+ * @param opt the options, or NULL for the default ones
+ * @return Hclust* the hierarchical clustering
+ */
+Hclust *hclustBuildTreeMatrix(List *objects,
+                              void (*fill)(double *condensed, size_t first, size_t last, size_t n, void *ctx),
+                              void *ctx, const HclustOptions *opt);
+
+/**
+ * @brief Builds a hierarchical clustering from merges computed elsewhere (e.g. by
+ *        neighbor joining). Node i < N is the i-th object of the list and node N + m
+ *        is the m-th merge, of nodes children[2m] (left) and children[2m + 1] (right),
+ *        which must have been created before it. The names are copied.
+ *
+ * @param objects the list of object names (char *)
+ * @param children the 2(N - 1) children of the merges
+ * @param dists the distances of the N - 1 merges
+ * @param branches the length of the branch from each of the 2N - 1 nodes to its parent,
+ *        written by hclustPrintTree instead of the differences of distances, or NULL
+ * @return Hclust* the hierarchical clustering, or NULL if the merges are not valid
+ */
+Hclust *hclustBuildFromMerges(List *objects, const uint32_t *children, const double *dists, const double *branches);
+
 /**
  * @brief Frees the hierarchical clustering from memory.
  * 
@@ -43,6 +178,16 @@ int hclustDepth(Hclust *hc);
  */
 int hclustNbLeaves(Hclust *hc);
 
+/**
+ * @brief Returns the name of the i-th object, in the order of the list given
+ *        to hclustBuildTree.
+ *
+ * @param hc the hierarchical clustering
+ * @param i the index of the object, between 0 and hclustNbLeaves(hc) - 1
+ * @return const char* the name of the object, or NULL if i is out of range
+ */
+const char *hclustObjectName(Hclust *hc, int i);
+
 /**
  * @brief Prints the dendrogram in the file fp (ie., with the command fprintf(fp,...)) in
  *        Newick format (see Ecampus).
@@ -52,6 +197,20 @@ int hclustNbLeaves(Hclust *hc);
  */
 void hclustPrintTree(FILE *fp, Hclust *hc);
 
+/**
+ * @brief Writes the dendrogram in the file fp in Newick format, with branch lengths
+ *        written with the given number of decimals. The tree is serialised into a
+ *        large buffer, so this is much faster than one fprintf per node.
+ *        hclustPrintTree(fp, hc) is hclustWriteNewick(fp, hc, 6), and the output is
+ *        byte-identical to fprintf's "%.*f".
+ *
+ * @param fp a pointer to the file
+ * @param hc the hierarchical clustering
+ * @param precision the number of decimals of the branch lengths, or a negative
+ *        value for the shortest representation that reads back to the same double
+ */
+void hclustWriteNewick(FILE *fp, Hclust *hc, int precision);
+
 /**
  * @brief Returns a list of lists, each containing the (names of the) objects
  *        contained in one of the clusters found by hierarchical clustering, when
@@ -64,6 +223,19 @@ void hclustPrintTree(FILE *fp, Hclust *hc);
  */
 List *hclustGetClustersDist(Hclust *hc, double distanceThreshold);
 
+/**
+ * @brief Same clusters as hclustGetClustersDist, given as a label vector:
+ *        labels[i] is the cluster of the i-th object (see hclustObjectName).
+ *        Clusters are numbered from 0 in the order of hclustGetClustersDist.
+ *        No list is built: the only allocation is the traversal stack.
+ *
+ * @param hc the hierarchical clustering
+ * @param distanceThreshold the distance threshold
+ * @param labels an array of hclustNbLeaves(hc) ints, filled by the function
+ * @return int the number of clusters
+ */
+int hclustLabelsDist(Hclust *hc, double distanceThreshold, int *labels);
+
 /**
  * @brief Returns a list of k lists, each containing the (names of the) objects
  *        contained in one of the clusters found by hierarchical clustering. The caller
@@ -75,6 +247,35 @@ List *hclustGetClustersDist(Hclust *hc, double distanceThreshold);
  */
 List *hclustGetClustersK(Hclust *hc, int k);
 
+/**
+ * @brief Same clusters as hclustGetClustersK, given as a label vector:
+ *        labels[i] is the cluster of the i-th object (see hclustObjectName).
+ *        Clusters are numbered from 0 in the order of hclustGetClustersK.
+ *
+ * @param hc the hierarchical clustering
+ * @param k the number of clusters
+ * @param labels an array of hclustNbLeaves(hc) ints, filled by the function
+ * @return int the number of clusters
+ */
+int hclustLabelsK(Hclust *hc, int k, int *labels);
+
+/**
+ * @brief Calls f(k, clusters, fparams) for every k from kmin to kmax, where clusters
+ *        is the list returned by hclustGetClustersK(hc, k). The cuts are computed
+ *        incrementally in a single pass over the merges: each additional k only
+ *        costs one split. The lists given to f are freed after the call.
+ *        Nothing is done if kmax < kmin, and the values of k larger than the
+ *        number of objects are skipped.
+ *
+ * @param hc the hierarchical clustering
+ * @param kmin the smallest number of clusters
+ * @param kmax the largest number of clusters
+ * @param f the function called for each k
+ * @param fparams the last argument given to f
+ */
+void hclustMapClustersK(Hclust *hc, int kmin, int kmax, void (*f)(int k, List *clusters, void *fparams),
+                        void *fparams);
+
 /**
  * @brief Returns a binary tree encoding for the dendrogram. The data at each interior node
  *        should be a pointer to a double containing the distance between the clusters represented
@@ -86,4 +287,45 @@ List *hclustGetClustersK(Hclust *hc, int k);
  */
 BTree *hclustGetTree(Hclust *hc);
 
+/**
+ * @brief Saves the dendrogram in a compact binary file: its merges (the two merged
+ *        clusters and their distance) followed by the object names. The file is in
+ *        the byte order of the machine. Branch lengths given to hclustBuildFromMerges
+ *        or read by hclustReadNewick are not saved.
+ *
+ * @param hc the hierarchical clustering
+ * @param filename the name of the file
+ * @return int 1 if the file was written, 0 otherwise
+ */
+int hclustSave(Hclust *hc, const char *filename);
+
+/**
+ * @brief Loads a dendrogram saved by hclustSave. The file is mapped in memory and
+ *        the names and distances are used in place: loading does not allocate
+ *        anything per node and costs O(N), instead of building the tree again.
+ *
+ * @param filename the name of the file
+ * @return Hclust* the hierarchical clustering, or NULL if the file cannot be read
+ *         or was not written by hclustSave
+ */
+Hclust *hclustLoad(const char *filename);
+
+/**
+ * @brief Reads the first tree of a Newick file (e.g. written by hclustPrintTree) in a
+ *        single linear pass, without recursion. Leaves are numbered in the order of the
+ *        file (see hclustObjectName). The distance of each merge is recovered from the
+ *        branch lengths: it is the largest height of its children plus their branch
+ *        length. Nodes with more than two children become a sequence of merges at the
+ *        same distance; nodes with a single child are skipped (their branch is added to
+ *        the child's). The branch lengths themselves are kept and written back by
+ *        hclustPrintTree, so a tree that is not ultrametric (e.g. built by neighbor
+ *        joining) keeps its lengths. Since branch lengths are rounded when written, the
+ *        distances are only as precise as the file.
+ *
+ * @param filename the name of the file
+ * @return Hclust* the hierarchical clustering, or NULL if the file cannot be read or
+ *         does not contain a valid Newick tree
+ */
+Hclust *hclustReadNewick(const char *filename);
+
 #endif
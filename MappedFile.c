@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L // Pour mmap, open et fstat
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "MappedFile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MF_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct MappedFile_t
+{
+    char *data;
+    size_t size;
+};
+
+#ifdef MF_MMAP
+
+MappedFile *mfOpen(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    MappedFile *mf = malloc(sizeof(MappedFile));
+    if (mf == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    mf->size = (size_t)st.st_size;
+    mf->data = NULL;
+    if (mf->size > 0) // mmap refuse une longueur nulle
+    {
+        void *p = mmap(NULL, mf->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            free(mf);
+            close(fd);
+            return NULL;
+        }
+        mf->data = p;
+    }
+
+    close(fd); // le mapping reste valide apres la fermeture
+    return mf;
+}
+
+void mfClose(MappedFile *mf)
+{
+    if (mf == NULL)
+        return;
+    if (mf->data != NULL)
+        munmap(mf->data, mf->size);
+    free(mf);
+}
+
+#else
+
+// Sans mmap, on lit tout le fichier d'un coup dans un buffer
+MappedFile *mfOpen(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return NULL;
+
+    MappedFile *mf = malloc(sizeof(MappedFile));
+    if (mf == NULL || fseek(fp, 0, SEEK_END) != 0)
+    {
+        free(mf);
+        fclose(fp);
+        return NULL;
+    }
+
+    long size = ftell(fp);
+    rewind(fp);
+    mf->size = size > 0 ? (size_t)size : 0;
+    mf->data = NULL;
+    if (mf->size > 0)
+    {
+        mf->data = malloc(mf->size);
+        if (mf->data == NULL || fread(mf->data, 1, mf->size, fp) != mf->size)
+        {
+            free(mf->data);
+            free(mf);
+            fclose(fp);
+            return NULL;
+        }
+    }
+
+    fclose(fp);
+    return mf;
+}
+
+void mfClose(MappedFile *mf)
+{
+    if (mf == NULL)
+        return;
+    free(mf->data);
+    free(mf);
+}
+
+#endif
+
+char *mfData(MappedFile *mf)
+{
+    return mf->data;
+}
+
+size_t mfSize(MappedFile *mf)
+{
+    return mf->size;
+}
@@ -0,0 +1,44 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+
+/**
+ * @brief Represents a whole file mapped in memory.
+ */
+typedef struct MappedFile_t MappedFile;
+
+/**
+ * @brief Maps the whole file in memory. The mapping is private: the contents can
+ *        be modified in place (e.g. to terminate strings) without changing the file.
+ *        On systems without mmap, the file is read in a buffer instead.
+ *
+ * @param filename the name of the file
+ * @return MappedFile* the mapped file, or NULL if it cannot be opened or mapped
+ */
+MappedFile *mfOpen(const char *filename);
+
+/**
+ * @brief Unmaps the file. The pointers into its contents become invalid.
+ *
+ * @param mf the mapped file
+ */
+void mfClose(MappedFile *mf);
+
+/**
+ * @brief Returns the contents of the file. They are not terminated by '\0'.
+ *
+ * @param mf the mapped file
+ * @return char* the first byte of the file (NULL if the file is empty)
+ */
+char *mfData(MappedFile *mf);
+
+/**
+ * @brief Returns the size of the file in bytes.
+ *
+ * @param mf the mapped file
+ * @return size_t the size of the file
+ */
+size_t mfSize(MappedFile *mf);
+
+#endif
@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L // Pour sysconf
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "Parallel.h"
+
+typedef struct
+{
+    void (*task)(int, int, void *);
+    void *ctx;
+    int id;
+    int nbThreads;
+} ThreadArgs;
+
+static void *threadMain(void *arg) // Point d'entrée de chaque thread
+{
+    ThreadArgs *a = (ThreadArgs *)arg;
+    a->task(a->id, a->nbThreads, a->ctx);
+    return NULL;
+}
+
+int parallelNbThreads(void)
+{
+    const char *env = getenv("HCLUST_THREADS");
+    if (env != NULL)
+    {
+        int n = atoi(env);
+        if (n > 0)
+            return n;
+    }
+
+#ifdef _SC_NPROCESSORS_ONLN
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores > 0)
+        return (int)cores;
+#endif
+    return 1;
+}
+
+void parallelRun(int nbThreads, void (*task)(int id, int nbThreads, void *ctx), void *ctx)
+{
+    if (nbThreads <= 1)
+    {
+        task(0, 1, ctx);
+        return;
+    }
+
+    pthread_t *threads = malloc(nbThreads * sizeof(pthread_t));
+    ThreadArgs *args = malloc(nbThreads * sizeof(ThreadArgs));
+    int *started = calloc(nbThreads, sizeof(int));
+    if (threads == NULL || args == NULL || started == NULL)
+    {
+        // pas assez de memoire pour les threads: on fait tout en serie
+        free(threads);
+        free(args);
+        free(started);
+        for (int id = 0; id < nbThreads; id++)
+            task(id, nbThreads, ctx);
+        return;
+    }
+
+    for (int id = 1; id < nbThreads; id++)
+    {
+        args[id].task = task;
+        args[id].ctx = ctx;
+        args[id].id = id;
+        args[id].nbThreads = nbThreads;
+        started[id] = (pthread_create(&threads[id], NULL, threadMain, &args[id]) == 0);
+    }
+
+    task(0, nbThreads, ctx); // le thread appelant fait le premier bloc
+
+    for (int id = 1; id < nbThreads; id++)
+    {
+        if (started[id])
+            pthread_join(threads[id], NULL);
+        else
+            task(id, nbThreads, ctx); // creation ratee: on le fait nous-meme
+    }
+
+    free(threads);
+    free(args);
+    free(started);
+}
+
+/// Pool de threads ///
+
+// Les workers attendent une nouvelle étape (generation change) sur start,
+// exécutent leur tache si leur id fait partie de l'étape, puis le dernier a
+// finir réveille l'appelant sur done.
+struct ParallelPool_t
+{
+    pthread_t *threads;
+    int nbWorkers; // workers démarrés, d'id 1 a nbWorkers
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation; // numéro de l'étape en cours
+    int pending;              // workers de l'étape qui n'ont pas fini
+    int stop;
+
+    // étape en cours
+    void (*task)(int, int, void *);
+    void *ctx;
+    int nbThreads;
+    int active; // les workers d'id 1..active ont une tache
+};
+
+typedef struct
+{
+    ParallelPool *pool;
+    int id;
+} WorkerArgs;
+
+static void *workerMain(void *arg) // Boucle d'un worker du pool
+{
+    WorkerArgs *a = (WorkerArgs *)arg;
+    ParallelPool *pool = a->pool;
+    int id = a->id;
+    free(a);
+
+    unsigned long seen = 0; // le pool commence a l'étape 0, meme si ce thread démarre en retard
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        while (pool->generation == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop)
+            break;
+        seen = pool->generation;
+        if (id > pool->active) // pas de tache pour ce worker a cette étape
+            continue;
+
+        void (*task)(int, int, void *) = pool->task;
+        void *ctx = pool->ctx;
+        int nbThreads = pool->nbThreads;
+        pthread_mutex_unlock(&pool->lock);
+
+        task(id, nbThreads, ctx);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ParallelPool *parallelPoolCreate(int nbThreads)
+{
+    ParallelPool *pool = malloc(sizeof(ParallelPool));
+    if (pool == NULL)
+        return NULL;
+
+    pool->threads = malloc((nbThreads > 1 ? nbThreads : 1) * sizeof(pthread_t));
+    if (pool->threads == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->stop = 0;
+    pool->nbThreads = 0;
+    pool->active = 0;
+    pool->nbWorkers = 0;
+
+    // les ids des workers restent contigus: on s'arrete au premier échec
+    for (int id = 1; id < nbThreads; id++)
+    {
+        WorkerArgs *a = malloc(sizeof(WorkerArgs));
+        if (a == NULL)
+            break;
+        a->pool = pool;
+        a->id = id;
+        if (pthread_create(&pool->threads[id], NULL, workerMain, a) != 0)
+        {
+            free(a);
+            break;
+        }
+        pool->nbWorkers = id;
+    }
+    return pool;
+}
+
+void parallelPoolRun(ParallelPool *pool, int nbThreads, void (*task)(int id, int nbThreads, void *ctx), void *ctx)
+{
+    int workers = pool != NULL && nbThreads > 1 ? nbThreads - 1 : 0; // ids 1..workers pour le pool
+    if (pool != NULL && workers > pool->nbWorkers)
+        workers = pool->nbWorkers;
+
+    if (workers > 0)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->task = task;
+        pool->ctx = ctx;
+        pool->nbThreads = nbThreads;
+        pool->active = workers;
+        pool->pending = workers;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    // les workers ne voient que les ids 1..workers: l'appelant fait les autres
+    task(0, nbThreads, ctx);
+    for (int id = workers + 1; id < nbThreads; id++)
+        task(id, nbThreads, ctx);
+
+    if (workers > 0)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending > 0)
+            pthread_cond_wait(&pool->done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void parallelPoolFree(ParallelPool *pool)
+{
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int id = 1; id <= pool->nbWorkers; id++)
+        pthread_join(pool->threads[id], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,63 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/**
+ * @brief Returns the number of threads to use for parallel stages. It is read
+ *        from the environment variable HCLUST_THREADS when it is set to a
+ *        positive integer, and defaults to the number of online cores otherwise.
+ *
+ * @return int the number of threads (at least 1)
+ */
+int parallelNbThreads(void);
+
+/**
+ * @brief Runs task(id, nbThreads, ctx) for every id in [0, nbThreads[, each call
+ *        in its own thread, and waits for all of them to finish. The call with
+ *        id 0 is run by the calling thread. If a thread cannot be created, its
+ *        task is run by the calling thread instead, so every id is always run.
+ *
+ * @param nbThreads the number of tasks/threads
+ * @param task the function run by every thread
+ * @param ctx the last argument given to task
+ */
+void parallelRun(int nbThreads, void (*task)(int id, int nbThreads, void *ctx), void *ctx);
+
+/**
+ * @brief A set of worker threads started once and reused by parallelPoolRun, for
+ *        algorithms that run a short parallel step many times in a loop (creating
+ *        threads at each step would cost more than the step itself).
+ */
+typedef struct ParallelPool_t ParallelPool;
+
+/**
+ * @brief Starts nbThreads - 1 worker threads, which wait for parallelPoolRun (the
+ *        calling thread is the last one). If some threads cannot be created, the
+ *        pool has fewer workers. Returns NULL if the pool cannot be allocated.
+ *
+ * @param nbThreads the number of threads, including the calling one
+ * @return ParallelPool* the pool
+ */
+ParallelPool *parallelPoolCreate(int nbThreads);
+
+/**
+ * @brief Same as parallelRun, but with the workers of the pool: runs task(id,
+ *        nbThreads, ctx) for every id in [0, nbThreads[ and waits for all of them to
+ *        finish. The id 0, and the ids that have no worker, are run by the calling
+ *        thread. A pool runs one step at a time: parallelPoolRun must not be called
+ *        from a task, or from two threads at once.
+ *
+ * @param pool the pool (if NULL, every id is run by the calling thread)
+ * @param nbThreads the number of tasks
+ * @param task the function run by every thread
+ * @param ctx the last argument given to task
+ */
+void parallelPoolRun(ParallelPool *pool, int nbThreads, void (*task)(int id, int nbThreads, void *ctx), void *ctx);
+
+/**
+ * @brief Stops the workers of the pool and frees it.
+ *
+ * @param pool the pool (can be NULL)
+ */
+void parallelPoolFree(ParallelPool *pool);
+
+#endif
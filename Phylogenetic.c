@@ -1,26 +1,106 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <math.h> //Pour log = ln
+#include "Arena.h"
+#include "Dict.h"
 #include "HierarchicalClustering.h"
 #include "Phylogenetic.h"
-#include "Dict.h"
 #include "LinkedList.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+// Séquence d'ADN encodée sur 2 bits par base (32 bases par mot de 64 bits):
+// A = 00, G = 01, C = 10, T = 11. Le bit de poids fort indique une pyrimidine,
+// donc une transversion change ce bit et une transition seulement l'autre.
+// valid a un bit (le bit de poids faible de chaque base) a 1 pour les bases
+// A, C, G ou T; les autres caractères (N, trous, ...) sont ignorés.
+typedef struct
+{
+    uint64_t *bases;
+    uint64_t *valid;
+    size_t nbWords;
+} PackedDNA;
 
+// Esquisse MinHash d'une séquence: les plus petites valeurs de hachage
+// (distinctes, triées) de ses k-mers canoniques
 typedef struct
 {
-    Dict *dna_sequences; // Dictionnaire à qui on donne le nom d'une espece et nous renvoie sa séquence d'ADN
+    uint64_t *hashes;
+    size_t size;
+} Sketch;
+
+typedef struct
+{
+    PackedDNA *dna_sequences; // Séquence d'ADN de chaque espece, dans l'ordre de la liste des noms
+    Sketch *sketches;         // ou son esquisse, pour la distance de Mash
+    int kmerSize;
 } PhyloDistParams;
 
-// Fonction d'aide pour la distance ADN
-static int isPurine(char base)
+#define LOW_BITS 0x5555555555555555ULL // bit de poids faible de chaque base
+
+#if defined(__GNUC__)
+#define popcount64(x) __builtin_popcountll(x)
+#else
+static int popcount64(uint64_t x)
 {
-    return (base == 'A' || base == 'G');
+    x = x - ((x >> 1) & LOW_BITS);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
 }
+#endif
 
-static int isPyrimidine(char base)
+static int baseCode(char base) // Code sur 2 bits d'une base, -1 si ce n'est pas une base
 {
-    return (base == 'C' || base == 'T');
+    switch (base)
+    {
+    case 'A':
+    case 'a':
+        return 0;
+    case 'G':
+    case 'g':
+        return 1;
+    case 'C':
+    case 'c':
+        return 2;
+    case 'T':
+    case 't':
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+// Distance de Kimura a partir des nombres de transitions et transversions
+// sur n sites comparables
+static double kimuraDistance(size_t n, size_t Transitions, size_t Transversions)
+{
+    if (n == 0)
+    {
+        return 0.0;
+    }
+
+    double P = (double)Transitions / n;
+    double Q = (double)Transversions / n;
+
+    double arg1 = 1.0 - 2.0 * P - Q;
+    double arg2 = 1.0 - 2.0 * Q;
+
+    const double EPSILON = 1e-12;
+    if (arg1 <= EPSILON)
+    {
+        arg1 = EPSILON;
+    }
+    if (arg2 <= EPSILON)
+    {
+        arg2 = EPSILON;
+    }
+
+    double dist = -0.5 * log(arg1) - 0.25 * log(arg2);
+
+    return dist;
 }
 
 double phyloDNADistance(char *dna1, char *dna2)
@@ -30,16 +110,16 @@ double phyloDNADistance(char *dna1, char *dna2)
 
     size_t n_min = (len1 < len2) ? len1 : len2;
 
-    int Transitions = 0;   // Transitions
-    int Transversions = 0; // Transversions
-    int n = 0;
+    size_t Transitions = 0;   // Transitions
+    size_t Transversions = 0; // Transversions
+    size_t n = 0;
 
     for (size_t i = 0; i < n_min; i++)
     {
-        char base1 = dna1[i];
-        char base2 = dna2[i];
+        int base1 = baseCode(dna1[i]);
+        int base2 = baseCode(dna2[i]);
 
-        if (base1 < 'A' || base2 < 'A')
+        if (base1 < 0 || base2 < 0)
         {
             continue;
         }
@@ -51,66 +131,635 @@ double phyloDNADistance(char *dna1, char *dna2)
             continue;
         }
 
-        if ((isPurine(base1) && isPurine(base2)) || (isPyrimidine(base1) && isPyrimidine(base2)))
+        if ((base1 ^ base2) & 2) // purine <-> pyrimidine
+        {
+            Transversions++;
+        }
+
+        else
         {
             Transitions++;
         }
+    }
 
+    return kimuraDistance(n, Transitions, Transversions);
+}
+
+static int packDNA(PackedDNA *p, const char *dna, size_t len) // Encode une séquence sur 2 bits
+{
+    p->nbWords = (len + 31) / 32;
+    p->bases = calloc(p->nbWords > 0 ? p->nbWords : 1, sizeof(uint64_t));
+    p->valid = calloc(p->nbWords > 0 ? p->nbWords : 1, sizeof(uint64_t));
+    if (p->bases == NULL || p->valid == NULL)
+    {
+        free(p->bases);
+        free(p->valid);
+        return 0;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        int code = baseCode(dna[i]);
+        if (code < 0)
+            continue;
+
+        unsigned shift = 2 * (i % 32);
+        p->bases[i / 32] |= (uint64_t)code << shift;
+        p->valid[i / 32] |= (uint64_t)1 << shift;
+    }
+    return 1;
+}
+
+static void freePackedDNA(PackedDNA *seqs, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        free(seqs[i].bases);
+        free(seqs[i].valid);
+    }
+    free(seqs);
+}
+
+// Meme distance que phyloDNADistance, calculée 32 bases a la fois: les sites
+// comparables, les bases différentes et les transversions sont des masques
+// dont on compte les bits
+static double packedDNADistance(const PackedDNA *a, const PackedDNA *b)
+{
+    size_t nbWords = a->nbWords < b->nbWords ? a->nbWords : b->nbWords;
+    size_t n = 0, Transitions = 0, Transversions = 0;
+
+    for (size_t w = 0; w < nbWords; w++)
+    {
+        uint64_t valid = a->valid[w] & b->valid[w];
+        uint64_t x = a->bases[w] ^ b->bases[w];
+        uint64_t transversion = (x >> 1) & valid;
+        uint64_t differ = (x | (x >> 1)) & valid;
+
+        n += popcount64(valid);
+        Transversions += popcount64(transversion);
+        Transitions += popcount64(differ & ~transversion);
+    }
+
+    return kimuraDistance(n, Transitions, Transversions);
+}
+
+/// Distance de Mash ///
+
+// Les k-mers (k <= 32) sont codés sur 2 bits par base comme PackedDNA; le
+// complément d'une base de code c est 3 - c. Un k-mer et son complément
+// inverse ont la meme forme canonique (la plus petite des deux), si bien que
+// le brin lu n'a pas d'importance.
+
+static uint64_t mixHash(uint64_t x) // Mélange 64 bits (finaliseur de splitmix64)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static int hashCmp(const void *x, const void *y)
+{
+    uint64_t a = *(const uint64_t *)x;
+    uint64_t b = *(const uint64_t *)y;
+    return (a > b) - (a < b);
+}
+
+static size_t sketchCompact(uint64_t *hashes, size_t len, size_t sketchSize) // Trie le tampon et ne garde
+                                                                            // que ses sketchSize plus
+                                                                            // petites valeurs distinctes
+{
+    qsort(hashes, len, sizeof(uint64_t), hashCmp);
+    size_t size = 0;
+    for (size_t h = 0; h < len && size < sketchSize; h++)
+        if (size == 0 || hashes[h] != hashes[size - 1])
+            hashes[size++] = hashes[h];
+    return size;
+}
+
+// Les sketchSize plus petites valeurs distinctes, en O(sketchSize) mémoire:
+// les valeurs sous le seuil (la plus grande valeur gardée, une fois
+// sketchSize valeurs trouvées) sont ajoutées a un tampon de 2 * sketchSize
+// valeurs, trié et réduit quand il est plein. Le seuil baisse vite, si bien
+// que presque toutes les valeurs sont écartées par une seule comparaison.
+static int sketchDNA(Sketch *sk, const char *dna, size_t len, int k, int sketchSize) // Esquisse d'une
+                                                                                       // séquence
+{
+    size_t cap = 2 * (size_t)(sketchSize > 0 ? sketchSize : 1);
+    uint64_t *hashes = malloc(cap * sizeof(uint64_t));
+    if (hashes == NULL)
+        return 0;
+
+    uint64_t mask = k == 32 ? ~0ULL : ((uint64_t)1 << (2 * k)) - 1;
+    unsigned shift = 2 * (unsigned)(k - 1);
+    uint64_t fwd = 0, rev = 0;
+    size_t nbHashes = 0;
+    int full = 0;            // sketchSize valeurs gardées: seules les plus petites que threshold comptent
+    uint64_t threshold = 0;
+    int valid = 0; // nombre de bases valides a la suite
+
+    for (size_t i = 0; i < len; i++)
+    {
+        int code = baseCode(dna[i]);
+        if (code < 0) // un k-mer ne contient que des bases A, C, G ou T
+        {
+            valid = 0;
+            continue;
+        }
+
+        fwd = ((fwd << 2) | (uint64_t)code) & mask;
+        rev = (rev >> 2) | ((uint64_t)(3 - code) << shift);
+        if (++valid < k)
+            continue;
+
+        uint64_t h = mixHash(fwd < rev ? fwd : rev);
+        if (full && h >= threshold)
+            continue;
+        hashes[nbHashes++] = h;
+        if (nbHashes == cap)
+        {
+            nbHashes = sketchCompact(hashes, nbHashes, (size_t)sketchSize);
+            if (nbHashes == (size_t)sketchSize)
+            {
+                full = 1;
+                threshold = hashes[nbHashes - 1];
+            }
+        }
+    }
+    size_t size = sketchCompact(hashes, nbHashes, (size_t)sketchSize);
+
+    sk->hashes = malloc((size > 0 ? size : 1) * sizeof(uint64_t)); // seule l'esquisse est gardée
+    if (sk->hashes == NULL)
+    {
+        free(hashes);
+        return 0;
+    }
+    memcpy(sk->hashes, hashes, size * sizeof(uint64_t));
+    sk->size = size;
+    free(hashes);
+    return 1;
+}
+
+static void freeSketches(Sketch *sketches, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        free(sketches[i].hashes);
+    free(sketches);
+}
+
+// Distance de Mash: l'indice de Jaccard j est estimé sur les s plus petites
+// valeurs de l'union des deux esquisses, puis D = -ln(2j / (1 + j)) / k.
+// Le cout ne dépend que de la taille des esquisses.
+static double mashDistance(const Sketch *a, const Sketch *b, int k)
+{
+    size_t s = a->size > b->size ? a->size : b->size;
+    size_t i = 0, j = 0, seen = 0, shared = 0;
+
+    while (seen < s && i < a->size && j < b->size)
+    {
+        if (a->hashes[i] == b->hashes[j])
+        {
+            shared++;
+            i++;
+            j++;
+        }
+        else if (a->hashes[i] < b->hashes[j])
+            i++;
         else
+            j++;
+        seen++;
+    }
+    if (seen < s) // une esquisse est épuisée: le reste de l'union vient de l'autre
+        seen += (a->size - i) + (b->size - j) < s - seen ? (a->size - i) + (b->size - j) : s - seen;
+
+    if (shared == 0)
+        return 1.0; // aucun k-mer commun
+    double jaccard = (double)shared / (double)seen;
+    if (jaccard >= 1.0)
+        return 0.0;
+    return -log(2.0 * jaccard / (1.0 + jaccard)) / k;
+}
+
+/// Neighbor joining ///
+
+// Neighbor joining a la RapidNJ: chaque ligne de la matrice garde ses
+// distances triées, et la recherche du minimum de
+//   Q(i, j) = (m - 2) d(i, j) - r(i) - r(j)   (m clusters, r(i) = somme des d(i, k))
+// s'arrete dans une ligne dès que (m - 2) d(i, j) - r(i) - max r dépasse le
+// meilleur Q trouvé: la plupart des lignes ne sont lues que sur quelques
+// cases. Le cluster fusionné prend la ligne de son premier fils.
+
+#define NJ_DEAD UINT32_MAX // ligne d'un noeud deja fusionné
+
+typedef struct
+{
+    float dist;    // distance arrondie vers le bas: la borne reste valable
+    uint32_t node; // noeud de l'autre extrémité (ignoré s'il a été fusionné)
+} NJEntry;
+
+typedef struct
+{
+    size_t n;
+    double *dist;      // matrice condensée entre les lignes
+    double *rowSum;    // r de chaque ligne
+    uint32_t *rowNode; // noeud qui occupe chaque ligne
+    uint32_t *nodeRow; // ligne de chaque noeud (feuilles 0..N-1, fusions N..2N-2)
+    NJEntry **sorted;  // distances triées de chaque ligne
+    size_t *sortedLen;
+    size_t *active; // lignes encore utilisées
+    size_t nbActive;
+} NJ;
+
+// Meilleure paire trouvée par un thread
+typedef struct
+{
+    double q;
+    size_t a, b; // lignes
+} NJBest;
+
+typedef struct
+{
+    NJ *nj;
+    double rowSumMax;
+    NJBest *best; // un par thread
+    double (*distFn)(size_t, size_t, void *);
+    void *distFnParams;
+} NJJob;
+
+static double *njAt(NJ *nj, size_t i, size_t j) // Case de la paire de lignes (i, j), i != j
+{
+    if (i > j)
+    {
+        size_t tmp = i;
+        i = j;
+        j = tmp;
+    }
+    return &nj->dist[i * nj->n - i * (i + 1) / 2 + (j - i - 1)];
+}
+
+static float floorFloat(double d) // Plus grand float <= d
+{
+    float f = (float)d;
+    if ((double)f > d)
+        f = nextafterf(f, -INFINITY);
+    return f;
+}
+
+static int njEntryCmp(const void *x, const void *y)
+{
+    const NJEntry *a = x;
+    const NJEntry *b = y;
+    if (a->dist != b->dist)
+        return a->dist < b->dist ? -1 : 1;
+    return (a->node > b->node) - (a->node < b->node);
+}
+
+static int njPairBefore(NJ *nj, double q, size_t a, size_t b, const NJBest *best) // 1 si (a, b) est
+                                                                                  // meilleure que best
+{
+    if (q != best->q)
+        return q < best->q;
+    if (best->a == best->b) // pas encore de paire
+        return 1;
+
+    // a Q égal, la paire de plus petits noeuds: le résultat ne dépend ni de
+    // l'ordre de lecture ni du nombre de threads
+    uint32_t x1 = nj->rowNode[a], y1 = nj->rowNode[b];
+    uint32_t x2 = nj->rowNode[best->a], y2 = nj->rowNode[best->b];
+    if (x1 > y1)
+    {
+        uint32_t t = x1;
+        x1 = y1;
+        y1 = t;
+    }
+    if (x2 > y2)
+    {
+        uint32_t t = x2;
+        x2 = y2;
+        y2 = t;
+    }
+    return x1 != x2 ? x1 < x2 : y1 < y2;
+}
+
+static void njDistRows(int id, int nbThreads, void *ctx) // Distances des lignes id, id + nbThreads, ...
+{
+    NJJob *job = ctx;
+    NJ *nj = job->nj;
+
+    for (size_t i = (size_t)id; i < nj->n; i += (size_t)nbThreads)
+    {
+        for (size_t j = i + 1; j < nj->n; j++)
+            *njAt(nj, i, j) = job->distFn(i, j, job->distFnParams);
+    }
+}
+
+static void njSortRows(int id, int nbThreads, void *ctx) // Lignes triées initiales: la paire (i, j)
+                                                         // n'est rangée que dans la ligne min(i, j)
+{
+    NJJob *job = ctx;
+    NJ *nj = job->nj;
+
+    for (size_t i = (size_t)id; i < nj->n; i += (size_t)nbThreads)
+    {
+        NJEntry *row = nj->sorted[i];
+        for (size_t j = i + 1; j < nj->n; j++)
         {
-            Transversions++;
+            row[j - i - 1].dist = floorFloat(*njAt(nj, i, j));
+            row[j - i - 1].node = (uint32_t)j;
         }
+        qsort(row, nj->sortedLen[i], sizeof(NJEntry), njEntryCmp);
     }
+}
+
+static void njSearchRows(int id, int nbThreads, void *ctx) // Minimum de Q sur une partie des lignes
+{
+    NJJob *job = ctx;
+    NJ *nj = job->nj;
+    NJBest *best = &job->best[id];
+    double m2 = (double)nj->nbActive - 2.0;
 
+    best->q = INFINITY;
+    best->a = best->b = 0;
+
+    for (size_t t = (size_t)id; t < nj->nbActive; t += (size_t)nbThreads)
+    {
+        size_t a = nj->active[t];
+        double ra = nj->rowSum[a];
+        const NJEntry *row = nj->sorted[a];
+
+        for (size_t e = 0; e < nj->sortedLen[a]; e++)
+        {
+            // borne inférieure de Q pour le reste de la ligne (avec une marge
+            // pour les arrondis: une paire a égalité n'est jamais écartée)
+            double bound = m2 * (double)row[e].dist - ra - job->rowSumMax;
+            if (bound > best->q + 1e-9 * fabs(best->q))
+                break;
+
+            uint32_t b = nj->nodeRow[row[e].node];
+            if (b == NJ_DEAD)
+                continue;
+
+            double q = m2 * *njAt(nj, a, b) - ra - nj->rowSum[b];
+            if (njPairBefore(nj, q, a, b, best))
+            {
+                best->q = q;
+                best->a = a;
+                best->b = b;
+            }
+        }
+    }
+}
+
+static void njFree(NJ *nj)
+{
+    if (nj->sorted != NULL)
+        for (size_t i = 0; i < nj->n; i++)
+            free(nj->sorted[i]);
+    free(nj->sorted);
+    free(nj->sortedLen);
+    free(nj->dist);
+    free(nj->rowSum);
+    free(nj->rowNode);
+    free(nj->nodeRow);
+    free(nj->active);
+}
+
+static Hclust *neighborJoining(List *names, double (*distFn)(size_t, size_t, void *), void *distFnParams)
+{
+    size_t n = llLength(names);
     if (n == 0)
+        return NULL;
+
+    NJ nj;
+    nj.n = n;
+    nj.nbActive = n;
+    nj.dist = malloc((n > 1 ? n * (n - 1) / 2 : 1) * sizeof(double));
+    nj.rowSum = calloc(n, sizeof(double));
+    nj.rowNode = malloc(n * sizeof(uint32_t));
+    nj.nodeRow = malloc((2 * n - 1) * sizeof(uint32_t));
+    nj.sorted = calloc(n, sizeof(NJEntry *));
+    nj.sortedLen = malloc(n * sizeof(size_t));
+    nj.active = malloc(n * sizeof(size_t));
+
+    // Résultat: fusions, distances (hauteurs) et longueurs de branches
+    uint32_t *children = malloc((n > 1 ? 2 * (n - 1) : 1) * sizeof(uint32_t));
+    double *heights = calloc(2 * n - 1, sizeof(double)); // hauteur de chaque noeud
+    double *branches = calloc(2 * n - 1, sizeof(double));
+
+    int nbThreads = parallelNbThreads();
+    NJBest *best = malloc((size_t)nbThreads * sizeof(NJBest));
+
+    int ok = nj.dist != NULL && nj.rowSum != NULL && nj.rowNode != NULL && nj.nodeRow != NULL &&
+             nj.sorted != NULL && nj.sortedLen != NULL && nj.active != NULL && children != NULL &&
+             heights != NULL && branches != NULL && best != NULL;
+
+    for (size_t i = 0; ok && i < n; i++)
     {
-        return 0.0;
+        nj.rowNode[i] = (uint32_t)i;
+        nj.nodeRow[i] = (uint32_t)i;
+        nj.active[i] = i;
+        nj.sortedLen[i] = n - 1 - i;
+        nj.sorted[i] = malloc((nj.sortedLen[i] > 0 ? nj.sortedLen[i] : 1) * sizeof(NJEntry));
+        ok = nj.sorted[i] != NULL;
     }
 
-    double P = (double)Transitions / n;
-    double Q = (double)Transversions / n;
+    NJJob job;
+    job.nj = &nj;
+    job.best = best;
+    job.distFn = distFn;
+    job.distFnParams = distFnParams;
 
-    double arg1 = 1.0 - 2.0 * P - Q;
-    double arg2 = 1.0 - 2.0 * Q;
+    // les memes threads servent au calcul des distances et a toutes les
+    // recherches du minimum de Q
+    ParallelPool *pool = ok && nbThreads > 1 ? parallelPoolCreate(nbThreads) : NULL;
 
-    const double EPSILON = 1e-12;
-    if (arg1 <= EPSILON)
+    if (ok)
     {
-        arg1 = EPSILON;
+        parallelPoolRun(pool, nbThreads, njDistRows, &job);
+        parallelPoolRun(pool, nbThreads, njSortRows, &job);
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = i + 1; j < n; j++)
+            {
+                nj.rowSum[i] += *njAt(&nj, i, j);
+                nj.rowSum[j] += *njAt(&nj, i, j);
+            }
     }
-    if (arg2 <= EPSILON)
+
+    for (size_t m = 0; ok && m + 1 < n; m++)
     {
-        arg2 = EPSILON;
+        // 1. Paire (a, b) qui minimise Q, cherchée par plusieurs threads
+        //    seulement s'il y a assez de lignes pour amortir leur synchronisation
+        size_t a, b;
+        if (nj.nbActive == 2)
+        {
+            a = nj.active[0];
+            b = nj.active[1];
+        }
+        else
+        {
+            job.rowSumMax = -INFINITY;
+            for (size_t t = 0; t < nj.nbActive; t++)
+                if (nj.rowSum[nj.active[t]] > job.rowSumMax)
+                    job.rowSumMax = nj.rowSum[nj.active[t]];
+
+            int searchThreads = (int)(nj.nbActive / 512);
+            if (searchThreads > nbThreads)
+                searchThreads = nbThreads;
+            if (searchThreads < 1)
+                searchThreads = 1;
+            parallelPoolRun(pool, searchThreads, njSearchRows, &job);
+
+            NJBest *winner = &best[0];
+            for (int t = 1; t < searchThreads; t++)
+                if (njPairBefore(&nj, best[t].q, best[t].a, best[t].b, winner))
+                    winner = &best[t];
+            a = winner->a;
+            b = winner->b;
+        }
+        if (nj.rowNode[a] > nj.rowNode[b]) // le plus petit noeud a gauche
+        {
+            size_t tmp = a;
+            a = b;
+            b = tmp;
+        }
+
+        // 2. Longueurs des branches vers le nouveau noeud u (une branche
+        //    négative est ramenée a 0 au profit de l'autre)
+        uint32_t na = nj.rowNode[a], nb = nj.rowNode[b];
+        uint32_t u = (uint32_t)(n + m);
+        double dab = *njAt(&nj, a, b);
+        double ba = nj.nbActive > 2
+                        ? dab / 2.0 + (nj.rowSum[a] - nj.rowSum[b]) / (2.0 * ((double)nj.nbActive - 2.0))
+                        : dab / 2.0; // les deux derniers: racine au milieu de la branche
+        if (ba < 0.0)
+            ba = 0.0;
+        if (ba > dab)
+            ba = dab > 0.0 ? dab : 0.0;
+        double bb = dab - ba > 0.0 ? dab - ba : 0.0;
+
+        children[2 * m] = na;
+        children[2 * m + 1] = nb;
+        branches[na] = ba;
+        branches[nb] = bb;
+        heights[u] = heights[na] + ba > heights[nb] + bb ? heights[na] + ba : heights[nb] + bb;
+
+        // 3. Distances de u aux autres lignes, rangées dans la ligne a
+        for (size_t t = 0; t < nj.nbActive; t++)
+        {
+            size_t k = nj.active[t];
+            if (k == a || k == b)
+                continue;
+            double *dak = njAt(&nj, a, k);
+            double dbk = *njAt(&nj, b, k);
+            double duk = (*dak + dbk - dab) / 2.0;
+            nj.rowSum[k] += duk - *dak - dbk;
+            *dak = duk;
+        }
+
+        for (size_t t = 0; t < nj.nbActive; t++) // b n'est plus une ligne
+        {
+            if (nj.active[t] == b)
+            {
+                nj.active[t] = nj.active[--nj.nbActive];
+                break;
+            }
+        }
+        free(nj.sorted[b]);
+        nj.sorted[b] = NULL;
+        nj.sortedLen[b] = 0;
+        nj.nodeRow[na] = NJ_DEAD;
+        nj.nodeRow[nb] = NJ_DEAD;
+        nj.nodeRow[u] = (uint32_t)a;
+        nj.rowNode[a] = u;
+
+        // 4. Nouvelle ligne triée de u, avec toutes les lignes restantes
+        free(nj.sorted[a]);
+        nj.sorted[a] = malloc(nj.nbActive * sizeof(NJEntry));
+        if (nj.sorted[a] == NULL)
+        {
+            ok = 0;
+            break;
+        }
+        nj.rowSum[a] = 0.0;
+        nj.sortedLen[a] = 0;
+        for (size_t t = 0; t < nj.nbActive; t++)
+        {
+            size_t k = nj.active[t];
+            if (k == a)
+                continue;
+            double duk = *njAt(&nj, a, k);
+            nj.rowSum[a] += duk;
+            nj.sorted[a][nj.sortedLen[a]].dist = floorFloat(duk);
+            nj.sorted[a][nj.sortedLen[a]].node = nj.rowNode[k];
+            nj.sortedLen[a]++;
+        }
+        qsort(nj.sorted[a], nj.sortedLen[a], sizeof(NJEntry), njEntryCmp);
     }
 
-    double dist = -0.5 * log(arg1) - 0.25 * log(arg2);
+    parallelPoolFree(pool);
+    Hclust *hc = ok ? hclustBuildFromMerges(names, children, heights + n, branches) : NULL;
 
-    return dist;
+    njFree(&nj);
+    free(best);
+    free(children);
+    free(heights);
+    free(branches);
+    return hc;
 }
 
 /// phyloTreeCreate ///
 
-#define MAXLINE_LENGTH 1024 // eviter les debordemnents de buffer avec fgets
-// 1024 borne raisonnable et standard pour la plupart des cas
-static double phyloDistFn(const char *obj1, const char *obj2, void *params)
+static double phyloDistFn(size_t obj1, size_t obj2, void *params)
 {
     PhyloDistParams *p = (PhyloDistParams *)params;
 
-    char *dna1 = (char *)dictSearch(p->dna_sequences, obj1);
-    char *dna2 = (char *)dictSearch(p->dna_sequences, obj2);
+    return packedDNADistance(&p->dna_sequences[obj1], &p->dna_sequences[obj2]);
+}
 
-    if (dna1 == NULL || dna2 == NULL) // si le fichier est mal formé
-    {
-        return 1e9; // Valeur arbitraire pour dire que la distance est trop grande
-    }
+static double mashDistFn(size_t obj1, size_t obj2, void *params)
+{
+    PhyloDistParams *p = (PhyloDistParams *)params;
 
-    return phyloDNADistance(dna1, dna2);
+    return mashDistance(&p->sketches[obj1], &p->sketches[obj2], p->kmerSize);
+}
+
+static void freeSequences(PackedDNA *DNA_seqs, Sketch *sketches, size_t n, int mash) // Libère les séquences
+                                                                                     // encodées ou les esquisses
+{
+    freePackedDNA(DNA_seqs, mash ? 0 : n);
+    freeSketches(sketches, mash ? n : 0);
+}
+
+void phyloDefaultOptions(PhyloOptions *opt)
+{
+    opt->method = PHYLO_HCLUST;
+    opt->distance = PHYLO_KIMURA;
+    opt->kmerSize = 21;
+    opt->sketchSize = 1000;
 }
 
 Hclust *phyloTreeCreate(char *dna_sequences)
 {
-    char buffer[MAXLINE_LENGTH];
-    FILE *file = fopen(dna_sequences, "r");
+    return phyloTreeCreateOpt(dna_sequences, NULL);
+}
+
+Hclust *phyloTreeCreateOpt(char *dna_sequences, const PhyloOptions *opt)
+{
+    PhyloOptions defaults;
+    if (opt == NULL)
+    {
+        phyloDefaultOptions(&defaults);
+        opt = &defaults;
+    }
+
+    int mash = opt->distance == PHYLO_MASH;
+    if (mash && (opt->kmerSize < 1 || opt->kmerSize > 32 || opt->sketchSize < 1))
+        return NULL;
+
+    // Le fichier est projeté en mémoire: les noms restent dans le fichier
+    // (terminés sur place) et les séquences sont encodées directement depuis
+    // celui-ci, sans limite de longueur de ligne
+    MappedFile *file = mfOpen(dna_sequences);
 
     if (file == NULL)
     {
@@ -118,61 +767,118 @@ Hclust *phyloTreeCreate(char *dna_sequences)
     }
 
     List *names = llCreateEmpty();
-    Dict *DNA_dict = dictCreate(1000);
+    size_t capacity = 1000;
+    PackedDNA *DNA_seqs = malloc(capacity * sizeof(PackedDNA));
+    Sketch *sketches = malloc(capacity * sizeof(Sketch));
+    if (DNA_seqs == NULL || sketches == NULL)
+    {
+        mfClose(file);
+        free(DNA_seqs);
+        free(sketches);
+        llFree(names);
+        return NULL;
+    }
+
+    // Table des noms déja lus, pour refuser les doublons; ses clés sont
+    // copiées dans une arène libérée en une fois
+    Arena *name_arena = arenaCreate(0);
+    Dict *name_table = dictCreateInArena(capacity, name_arena);
 
-    while (fgets(buffer, MAXLINE_LENGTH, file))
+    char *cur = mfData(file);
+    char *end = cur + mfSize(file);
+
+    while (cur < end)
     {
-        buffer[strcspn(buffer, "\r\n")] = '\0';
+        char *eol = memchr(cur, '\n', end - cur);
+        if (eol == NULL)
+            eol = end; // derniere ligne sans retour a la ligne
+
+        char *line = cur;
+        char *line_end = eol;
+        cur = eol + 1;
+
+        if (line_end > line && line_end[-1] == '\r')
+            line_end--;
 
-        if (buffer[0] == '\0')
+        if (line_end == line)
         {
             continue;
         }
 
-        char *comma = strchr(buffer, ',');
+        char *comma = memchr(line, ',', line_end - line);
         if (comma == NULL)
         {
             continue; // Ligne mal formée
         }
 
-        *comma = '\0';
-        char *name_in = buffer;
+        *comma = '\0'; // le nom est terminé sur place
+        char *name = line;
         char *dna_in = comma + 1;
 
-        char *name = malloc(strlen(name_in) + 1);
-        if (name == NULL)
+        if (dictContains(name_table, name)) // deux séquences portent le même nom
         {
-            fclose(file);
+            mfClose(file);
+            freeSequences(DNA_seqs, sketches, llLength(names), mash);
             llFree(names);
-            dictFree(DNA_dict);
+            dictFree(name_table);
+            arenaFree(name_arena);
             return NULL;
         }
-        strcpy(name, name_in);
 
-        char *dna = malloc(strlen(dna_in) + 1);
-        if (dna == NULL)
+        if (llLength(names) == capacity) // agrandit le tableau des séquences
         {
-            free(name);
-            fclose(file);
+            PackedDNA *bigger = realloc(DNA_seqs, 2 * capacity * sizeof(PackedDNA));
+            if (bigger != NULL)
+                DNA_seqs = bigger;
+            Sketch *biggerSketches = realloc(sketches, 2 * capacity * sizeof(Sketch));
+            if (biggerSketches != NULL)
+                sketches = biggerSketches;
+            if (bigger == NULL || biggerSketches == NULL)
+            {
+                mfClose(file);
+                freeSequences(DNA_seqs, sketches, llLength(names), mash);
+                llFree(names);
+                dictFree(name_table);
+                arenaFree(name_arena);
+                return NULL;
+            }
+            capacity *= 2;
+        }
+
+        // la séquence est encodée (ou esquissée) une seule fois, a la lecture
+        int ok = mash ? sketchDNA(&sketches[llLength(names)], dna_in, line_end - dna_in, opt->kmerSize,
+                                  opt->sketchSize)
+                      : packDNA(&DNA_seqs[llLength(names)], dna_in, line_end - dna_in);
+        if (!ok)
+        {
+            mfClose(file);
+            freeSequences(DNA_seqs, sketches, llLength(names), mash);
             llFree(names);
-            dictFree(DNA_dict);
+            dictFree(name_table);
+            arenaFree(name_arena);
             return NULL;
         }
-        strcpy(dna, dna_in);
-
+        dictInsert(name_table, name, NULL);
         llInsertLast(names, name);
-        dictInsert(DNA_dict, name, dna);
     }
-
-    fclose(file);
+    dictFree(name_table);
+    arenaFree(name_arena);
 
     PhyloDistParams params;
-    params.dna_sequences = DNA_dict;
-
-    Hclust *hc = hclustBuildTree(names, phyloDistFn, &params);
-
-    dictFreeValues(DNA_dict, free); // Libération des séquences d'ADN
-    llFreeData(names);              // Libération des noms
+    params.dna_sequences = DNA_seqs;
+    params.sketches = sketches;
+    params.kmerSize = opt->kmerSize;
+    double (*distFn)(size_t, size_t, void *) = mash ? mashDistFn : phyloDistFn;
+
+    Hclust *hc;
+    if (opt->method == PHYLO_NJ)
+        hc = neighborJoining(names, distFn, &params);
+    else
+        hc = hclustBuildTreeIdx(names, distFn, &params, NULL);
+
+    freeSequences(DNA_seqs, sketches, llLength(names), mash); // Libération des séquences d'ADN
+    llFree(names);                            // les noms sont dans le fichier
+    mfClose(file);
 
     return hc;
 }
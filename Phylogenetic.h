@@ -5,7 +5,9 @@
 
 /**
  * @brief Computes the distance between two DNA sequences as explained in the
- *        project description
+ *        project description. Only the sites where both sequences have one of the
+ *        bases A, C, G or T (in upper or lower case) are compared; the other
+ *        characters (N, gaps, ...) are ignored.
  * 
  * @param dna1 the first DNA sequence
  * @param dna2 the second DNA sequence
@@ -22,4 +24,60 @@ double phyloDNADistance(char *dna1, char *dna2);
  */
 Hclust *phyloTreeCreate(char *filename);
 
+/**
+ * @brief The methods available to build the tree.
+ */
+typedef enum
+{
+    PHYLO_HCLUST, // hierarchical clustering (hclustBuildTree), the default
+    PHYLO_NJ      // neighbor joining, rooted at the middle of the last joined branch
+} PhyloMethod;
+
+/**
+ * @brief The distances available between two sequences.
+ */
+typedef enum
+{
+    PHYLO_KIMURA, // phyloDNADistance on the aligned sequences, the default
+    PHYLO_MASH    // Mash distance estimated from MinHash sketches of the k-mers
+} PhyloDistance;
+
+/**
+ * @brief Options of phyloTreeCreateOpt.
+ */
+typedef struct
+{
+    PhyloMethod method;
+    PhyloDistance distance;
+    int kmerSize;   // k, between 1 and 32 (PHYLO_MASH only, 21 by default)
+    int sketchSize; // number of hashes kept per sequence (PHYLO_MASH only, 1000 by default)
+} PhyloOptions;
+
+/**
+ * @brief Fills opt with the default options (the ones used by phyloTreeCreate).
+ *
+ * @param opt the options to initialise
+ */
+void phyloDefaultOptions(PhyloOptions *opt);
+
+/**
+ * @brief Same as phyloTreeCreate, with options. Neighbor joining uses sorted rows
+ *        and a lower bound on Q to skip most pairs (as RapidNJ does), and searches
+ *        the rows with several threads; its result does not depend on the number of
+ *        threads. Its branch lengths are written by hclustPrintTree (negative ones
+ *        are set to 0), and the distance of each merge is the largest distance from
+ *        the merged node to its leaves.
+ *
+ *        With PHYLO_MASH, each sequence is reduced when it is read to a sketch: the
+ *        sketchSize smallest hashes of its canonical k-mers (k-mers with other
+ *        characters than A, C, G or T are skipped). The sequences do not need to be
+ *        aligned, and the cost of a distance only depends on sketchSize.
+ *
+ * @param filename the name of the file containing the sequences
+ * @param opt the options, or NULL for the default ones
+ * @return Hclust* the hierarchical clustering, or NULL if the file cannot be read,
+ *         two sequences have the same name or the options are not valid
+ */
+Hclust *phyloTreeCreateOpt(char *filename, const PhyloOptions *opt);
+
 #endif
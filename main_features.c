@@ -1,50 +1,185 @@
 // gcc -o clusteranimal main_animal.c BTree.c Dict.c LinkedList.c HierarchicalClustering.c
 
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
+#include "Arena.h"
 #include "Dict.h"
 #include "LinkedList.h"
 #include "BTree.h"
 #include "HierarchicalClustering.h"
+#include "FeatureMatrix.h"
+#include "MappedFile.h"
 
-#define MAXLINELENGTH 2000
+static double euclideanDistance(size_t obj1, size_t obj2, void *param)
+{
+    FeatureMatrix *features = param;
+
+    return fmDistance(features, obj1, obj2);
+}
+
+// At least this many features: all the distances are computed at once by
+// fmCondensedDistances (for fewer, the per-pair kernel is as fast and exact)
+#define BULK_MIN_FEATURES 32
+
+static void euclideanMatrix(double *condensed, size_t first, size_t last, size_t n, void *param)
+{
+    FeatureMatrix *features = param;
+
+    (void)n;
+    fmCondensedDistances(features, first, last, condensed);
+}
 
-typedef struct ParamFeatures_t
+// Exact powers of ten representable as doubles
+static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                               1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Length of word if [s, end[ starts with it (ignoring case), 0 otherwise
+static int matchWord(const char *s, const char *end, const char *word)
 {
-    Dict *dict;
-    int nbFeatures;
-} ParamFeatures;
+    size_t len = strlen(word);
+    if ((size_t)(end - s) < len)
+        return 0;
+    for (size_t i = 0; i < len; i++)
+        if (tolower((unsigned char)s[i]) != word[i])
+            return 0;
+    return (int)len;
+}
 
-static double euclideanDistance(const char *obj1, const char *obj2, void *param)
+/**
+ * Parses the number in [s, end[ into *value (without locale and without
+ * needing a terminating '\0'), and returns 0 if the field is not a complete
+ * number: an optional sign, then digits with an optional decimal point and
+ * exponent, or "inf", "infinity" or "nan" (any case), with optional spaces
+ * around. Hexadecimal numbers and empty fields are rejected.
+ * When the digits fit in 53 bits and the decimal exponent is at most 22, a
+ * single multiplication or division by an exact power of ten gives the
+ * correctly rounded value. Otherwise (more than 19 significant digits, or a
+ * large exponent) the first 19 digits are scaled in long double precision,
+ * which can be one unit in the last place away from the correctly rounded
+ * value.
+ */
+static int parseDouble(const char *s, const char *end, double *value)
 {
-    ParamFeatures *pfparam = param;
-    Dict *d = pfparam->dict;
-    int nbf = pfparam->nbFeatures;
+    while (s < end && (*s == ' ' || *s == '\t'))
+        s++;
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
 
-    double *feat1 = dictSearch(d, obj1);
-    double *feat2 = dictSearch(d, obj2);
-    double sum = 0.0;
+    int negative = 0;
+    if (s < end && (*s == '-' || *s == '+'))
+        negative = (*s++ == '-');
+
+    int len;
+    if ((len = matchWord(s, end, "infinity")) != 0 || (len = matchWord(s, end, "inf")) != 0)
+    {
+        *value = negative ? -INFINITY : INFINITY;
+        return s + len == end;
+    }
+    if ((len = matchWord(s, end, "nan")) != 0)
+    {
+        *value = NAN;
+        return s + len == end;
+    }
+
+    unsigned long long mantissa = 0;
+    int nbDigits = 0; // significant digits kept in mantissa
+    int nbRead = 0;   // digits read, before and after the point
+    int exp10 = 0;
+    int exact = 1; // 0 if some non-zero digit was dropped
+
+    while (s < end && *s >= '0' && *s <= '9')
+    {
+        if (nbDigits < 19)
+        {
+            mantissa = mantissa * 10 + (unsigned)(*s - '0');
+            if (mantissa != 0)
+                nbDigits++;
+        }
+        else
+        {
+            exp10++;
+            if (*s != '0')
+                exact = 0;
+        }
+        nbRead++;
+        s++;
+    }
+    if (s < end && *s == '.')
+    {
+        s++;
+        while (s < end && *s >= '0' && *s <= '9')
+        {
+            if (nbDigits < 19)
+            {
+                mantissa = mantissa * 10 + (unsigned)(*s - '0');
+                if (mantissa != 0)
+                    nbDigits++;
+                exp10--;
+            }
+            else if (*s != '0')
+                exact = 0;
+            nbRead++;
+            s++;
+        }
+    }
+    if (nbRead == 0) // no digit: empty field, "0x1p3", text...
+        return 0;
 
-    for (int i = 0; i < nbf; i++)
+    if (s < end && (*s == 'e' || *s == 'E'))
     {
-        double diff = (feat1[i] - feat2[i]);
-        sum += diff * diff;
+        s++;
+        int expNegative = 0;
+        if (s < end && (*s == '-' || *s == '+'))
+            expNegative = (*s++ == '-');
+        if (s == end || *s < '0' || *s > '9')
+            return 0;
+
+        int exponent = 0;
+        while (s < end && *s >= '0' && *s <= '9')
+        {
+            if (exponent < 100000)
+                exponent = exponent * 10 + (*s - '0');
+            s++;
+        }
+        exp10 += expNegative ? -exponent : exponent;
     }
+    if (s != end) // trailing characters
+        return 0;
+
+    double v;
+    if (mantissa == 0)
+        v = 0.0;
+    else if (exact && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22)
+        v = exp10 < 0 ? (double)mantissa / POW10[-exp10] : (double)mantissa * POW10[exp10];
+    else
+        v = (double)((long double)mantissa * powl(10.0L, (long double)exp10));
 
-    return sqrt(sum);
+    *value = negative ? -v : v;
+    return 1;
 }
 
-static Hclust *FeatureTreeCreate(char *filename)
+static Hclust *FeatureTreeCreate(char *filename, const HclustOptions *opt)
 {
-    char buffer[MAXLINELENGTH];
+    // The file is mapped in memory: names are terminated in place and the
+    // features are parsed directly into the matrix, whatever the line width
+    MappedFile *file = mfOpen(filename);
+    if (file == NULL)
+    {
+        fprintf(stderr, "FeatureTreeCreate: cannot open the file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
 
-    FILE *fp = fopen(filename, "r");
+    char *cur = mfData(file);
+    char *end = cur + mfSize(file);
 
-    if (!fgets(buffer, MAXLINELENGTH, fp))
+    char *header_end = cur == NULL ? NULL : memchr(cur, '\n', end - cur);
+    if (header_end == NULL)
     {
         fprintf(stderr, "FeatureTreeCreate: the file is empty.\n");
         exit(EXIT_FAILURE);
@@ -52,87 +187,232 @@ static Hclust *FeatureTreeCreate(char *filename)
 
     // Count the number of features from the header
     int nbFeatures = 0;
-    int i = 0;
-    while (buffer[i] != '\n' && buffer[i] != '\0')
+    for (char *c = cur; c < header_end; c++)
     {
-        if (buffer[i] == ',')
+        if (*c == ',')
             nbFeatures++;
-        i++;
     }
+    if (nbFeatures == 0)
+    {
+        fprintf(stderr, "FeatureTreeCreate: the header has no feature.\n");
+        exit(EXIT_FAILURE);
+    }
+    cur = header_end + 1;
+
+    // Count the lines to allocate the matrix once
+    size_t nbLines = 0;
+    for (char *c = cur; c < end && (c = memchr(c, '\n', end - c)) != NULL; c++)
+        nbLines++;
 
-    // collect the data
+    // collect the data; the name table only detects duplicated names, its
+    // keys are copied into an arena released in one go
     List *names = llCreateEmpty();
-    Dict *dicfeatures = dictCreate(1000);
+    Arena *nameArena = arenaCreate(0);
+    Dict *nameTable = dictCreateInArena(nbLines + 1, nameArena);
+    FeatureMatrix *features = fmCreate(nbFeatures, nbLines + 1);
 
-    while (fgets(buffer, MAXLINELENGTH, fp))
+    while (cur < end)
     {
-        int lenstr = strlen(buffer) - 1;
-        buffer[lenstr] = '\0'; // replace \n with \0
+        char *line_end = memchr(cur, '\n', end - cur);
+        if (line_end == NULL)
+            line_end = end; // last line without a newline
+        char *next = line_end + 1;
+        if (line_end > cur && line_end[-1] == '\r')
+            line_end--;
+
+        if (line_end == cur) // empty line
+        {
+            cur = next;
+            continue;
+        }
 
         // Extract species name
-        int i = 0;
-        while (buffer[i] != ',')
-            i++;
-        buffer[i] = '\0';
-
-        char *objectName = malloc((i + 1) * sizeof(char));
-        strcpy(objectName, buffer);
+        char *comma = memchr(cur, ',', line_end - cur);
+        if (comma == NULL)
+        {
+            fprintf(stderr, "FeatureTreeCreate: not enough features for object %.*s.\n",
+                    (int)(line_end - cur), cur);
+            exit(EXIT_FAILURE);
+        }
+        *comma = '\0';
 
+        char *objectName = cur;
+        if (dictContains(nameTable, objectName))
+        {
+            fprintf(stderr, "FeatureTreeCreate: duplicate object name %s.\n", objectName);
+            exit(EXIT_FAILURE);
+        }
+        dictInsert(nameTable, objectName, NULL);
         llInsertLast(names, objectName);
 
-        double *featureVector = malloc(nbFeatures * sizeof(double));
+        double *featureVector = fmAddRow(features);
         int pos = 0;
-        i++;
-        while (i < lenstr && pos < nbFeatures)
-        {
-            int j = i;
-            while (j < lenstr && buffer[j] != ',')
-                j++;
-            if (buffer[j] == ',')
-                buffer[j] = '\0';
-            featureVector[pos] = atof(buffer + i);
+        char *field = comma + 1;
+        while (field < line_end && pos < nbFeatures)
+        {
+            char *field_end = memchr(field, ',', line_end - field);
+            if (field_end == NULL)
+                field_end = line_end;
+            if (!parseDouble(field, field_end, &featureVector[pos]))
+            {
+                fprintf(stderr, "FeatureTreeCreate: invalid number \"%.*s\" for object %s.\n",
+                        (int)(field_end - field), field, objectName);
+                exit(EXIT_FAILURE);
+            }
             pos++;
-            i = j + 1;
+            field = field_end + 1;
         }
         if (pos != nbFeatures)
         {
             fprintf(stderr, "FeatureTreeCreate: not enough features for object %s.\n", objectName);
             exit(EXIT_FAILURE);
         }
-        dictInsert(dicfeatures, objectName, featureVector);
+        cur = next;
     }
 
+    if (llLength(names) == 0)
+    {
+        fprintf(stderr, "FeatureTreeCreate: the file has no object.\n");
+        exit(EXIT_FAILURE);
+    }
     printf("%zu objects read, with %d features\n", llLength(names), nbFeatures);
-
-    ParamFeatures pf;
-    pf.nbFeatures = nbFeatures;
-    pf.dict = dicfeatures;
+    dictFree(nameTable);
+    arenaFree(nameArena);
 
     printf("Construction of the phylogenetic tree\n");
 
-    Hclust *hc = hclustBuildTree(names, euclideanDistance, &pf);
+    Hclust *hc;
+    if (fmNbFeatures(features) >= BULK_MIN_FEATURES && opt->algorithm != HCLUST_LOW_MEMORY)
+        hc = hclustBuildTreeMatrix(names, euclideanMatrix, features, opt);
+    else
+        hc = hclustBuildTreeIdx(names, euclideanDistance, features, opt);
 
-    // free the memory
-    dictFreeValues(pf.dict, free);
-    llFreeData(names);
-    fclose(fp);
+    // free the memory (the names are in the mapped file)
+    fmFree(features);
+    llFree(names);
+    mfClose(file);
 
     return hc;
 }
 
+static void printClusters(List *clusters)
+{
+    Node *p = llHead(clusters);
+    int i = 1;
+    while (p != NULL)
+    {
+        printf("- Cluster %d (size=%zu)", i, llLength(llData(p)));
+        Node *first = llHead(llData(p));
+        Node *pp = first;
+        while (pp != NULL)
+        {
+            if (pp == first)
+                printf(": %s", (char *)llData(pp));
+            else
+                printf(", %s", (char *)llData(pp));
+            pp = llNext(pp);
+        }
+        printf("\n");
+        i++;
+        p = llNext(p);
+    }
+}
+
+static void printClustersK(int k, List *clusters, void *params)
+{
+    (void)params;
+    printf("Clusters for k=%d:\n", k);
+    printClusters(clusters);
+}
+
+/**
+ * Writes the label vector as a "name,cluster" CSV file. Clusters are numbered
+ * from 1, like in the printed clusters. The file is written in a single pass
+ * through a large stdio buffer.
+ */
+static void writeLabels(const char *filename, Hclust *hc, const int *labels)
+{
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Unable to open file %s.\n", filename);
+        exit(1);
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+
+    fputs("name,cluster\n", fp);
+    int nbObjects = hclustNbLeaves(hc);
+    for (int i = 0; i < nbObjects; i++)
+    {
+        // entier ecrit a la main, sans passer par fprintf
+        char digits[16];
+        int len = 0;
+        unsigned int c = (unsigned int)labels[i] + 1;
+        do
+        {
+            digits[sizeof(digits) - 1 - len++] = (char)('0' + c % 10);
+            c /= 10;
+        } while (c > 0);
+
+        fputs(hclustObjectName(hc, i), fp);
+        fputc(',', fp);
+        fwrite(digits + sizeof(digits) - len, 1, (size_t)len, fp);
+        fputc('\n', fp);
+    }
+    fclose(fp);
+}
+
+/*
+ * Reads the argument of -k: either a number of clusters "k" or a range
+ * "kmin:kmax". Returns 0 if it is malformed, if kmin < 1 or if kmax < kmin.
+ */
+static int parseClusterRange(const char *s, int *kmin, int *kmax)
+{
+    char *end;
+    if (!isdigit((unsigned char)*s))
+        return 0;
+    long lo = strtol(s, &end, 10);
+    long hi = lo;
+    if (*end == ':')
+    {
+        s = end + 1;
+        if (!isdigit((unsigned char)*s))
+            return 0;
+        hi = strtol(s, &end, 10);
+    }
+    if (*end != '\0' || lo < 1 || hi < lo || hi > INT_MAX)
+        return 0;
+
+    *kmin = (int)lo;
+    *kmax = (int)hi;
+    return 1;
+}
+
+static void usage(const char *error)
+{
+    fprintf(stderr, "%s\n"
+                    "Usage: hcfeatures (-th <threshold> | -k <num_clusters>[:<max_clusters>])\n"
+                    "       (<input_file> | -load <tree_file> | -newick <newick_file>)\n"
+                    "       [<output_file>] [-labels <labels_file>] [-save <tree_file>]\n"
+                    "       [-linkage (single | complete | average | ward)]\n"
+                    "       [-storage (double | float | uint16)]\n"
+                    "-load reads a tree saved with -save, -newick a tree in Newick format;\n"
+                    "-linkage and -storage only apply when the tree is built from a CSV file.\n",
+            error);
+    exit(0);
+}
+
 int main(int argc, char *argv[])
 {
 
     if (argc < 4)
     {
-        fprintf(stderr, "Not enough arguments.\n"
-                        "Usage: hcfeatures (-th <threshold> | -k <num_clusters>) "
-                        "<input_file> [<output_file>]\n");
-        exit(0);
+        usage("Not enough arguments.");
     }
 
     double threshold = 0.0;
     int num_clusters = 0;
+    int max_clusters = 0;
     int use_threshold = 1;
     char *ifile = NULL;
 
@@ -144,19 +424,125 @@ int main(int argc, char *argv[])
     }
     else if (strcmp(argv[1], "-k") == 0)
     {
-        num_clusters = atoi(argv[2]);
+        // -k 2:25 donne les clusters pour chaque k de 2 a 25
+        if (!parseClusterRange(argv[2], &num_clusters, &max_clusters))
+            usage("Invalid number of clusters.");
         use_threshold = 0;
         ifile = argv[3];
     }
     else
     {
-        fprintf(stderr, "Invalid option.\n"
-                        "Usage: hcfeatures (-th <threshold> | -k <num_clusters>) "
-                        "<input_file> [<output_file>]\n");
+        usage("Invalid option.");
+    }
+
+    // l'entrée est un fichier CSV, ou un arbre déja construit (-load ou -newick)
+    int load = strcmp(argv[3], "-load") == 0;
+    int newick = strcmp(argv[3], "-newick") == 0;
+    int firstOption = 4;
+    if (load || newick)
+    {
+        if (argc < 5)
+            usage("Not enough arguments.");
+        ifile = argv[4];
+        firstOption = 5;
+    }
+
+    // arguments optionnels: fichier de sortie, fichier des etiquettes,
+    // sauvegarde de l'arbre, lien entre clusters et stockage des distances
+    char *ofile = NULL;
+    char *lfile = NULL;
+    char *sfile = NULL;
+    int buildOptions = 0; // -linkage ou -storage donné
+    HclustOptions options;
+    hclustDefaultOptions(&options);
+    for (int a = firstOption; a < argc; a++)
+    {
+        if (strcmp(argv[a], "-labels") == 0 && a + 1 < argc)
+            lfile = argv[++a];
+        else if (strcmp(argv[a], "-save") == 0 && a + 1 < argc)
+            sfile = argv[++a];
+        else if (strcmp(argv[a], "-linkage") == 0 && a + 1 < argc)
+        {
+            a++;
+            buildOptions = 1;
+            if (strcmp(argv[a], "single") == 0)
+                options.linkage = HCLUST_SINGLE;
+            else if (strcmp(argv[a], "complete") == 0)
+                options.linkage = HCLUST_COMPLETE;
+            else if (strcmp(argv[a], "average") == 0)
+                options.linkage = HCLUST_AVERAGE;
+            else if (strcmp(argv[a], "ward") == 0)
+                options.linkage = HCLUST_WARD;
+            else
+            {
+                fprintf(stderr, "Invalid linkage %s.\n", argv[a]);
+                exit(0);
+            }
+        }
+        else if (strcmp(argv[a], "-storage") == 0 && a + 1 < argc)
+        {
+            a++;
+            buildOptions = 1;
+            if (strcmp(argv[a], "double") == 0)
+                options.storage = HCLUST_DOUBLE;
+            else if (strcmp(argv[a], "float") == 0)
+                options.storage = HCLUST_FLOAT;
+            else if (strcmp(argv[a], "uint16") == 0)
+                options.storage = HCLUST_UINT16;
+            else
+            {
+                fprintf(stderr, "Invalid storage %s.\n", argv[a]);
+                exit(0);
+            }
+        }
+        else
+            ofile = argv[a];
+    }
+
+    if (lfile != NULL && !use_threshold && max_clusters != num_clusters)
+    {
+        fprintf(stderr, "Option -labels needs a single number of clusters.\n");
         exit(0);
     }
 
-    Hclust *hc = FeatureTreeCreate(ifile);
+    if ((load || newick) && buildOptions)
+    {
+        fprintf(stderr, "Options -linkage and -storage can not be used with a loaded tree.\n");
+        exit(0);
+    }
+
+    // un arbre sauvé avec -save, ou écrit au format Newick, est rechargé tel
+    // quel, sans le reconstruire
+    Hclust *hc;
+    if (load || newick)
+    {
+        hc = load ? hclustLoad(ifile) : hclustReadNewick(ifile);
+        if (hc == NULL)
+        {
+            fprintf(stderr, "%s is not a valid %s file.\n", ifile, load ? "tree" : "Newick");
+            exit(1);
+        }
+        printf("Dendrogram of %d objects loaded from %s\n", hclustNbLeaves(hc), ifile);
+    }
+    else
+        hc = FeatureTreeCreate(ifile, &options);
+
+    // on ne peut pas former plus de clusters qu'il n'y a d'objets
+    int nbObjects = hclustNbLeaves(hc);
+    if (!use_threshold && max_clusters > nbObjects)
+    {
+        fprintf(stderr, "Only %d objects: the number of clusters is limited to %d.\n", nbObjects, nbObjects);
+        max_clusters = nbObjects;
+        if (num_clusters > nbObjects)
+            num_clusters = nbObjects;
+    }
+
+    if (sfile != NULL)
+    {
+        printf("Saving the tree in file %s.\n", sfile);
+        if (!hclustSave(hc, sfile))
+            fprintf(stderr, "Unable to save the tree in file %s.\n", sfile);
+    }
 
     // print the clusters
     List *clusters = NULL;
@@ -166,38 +552,42 @@ int main(int argc, char *argv[])
         clusters = hclustGetClustersDist(hc, threshold);
         printf("Clusters (%zu) with a distance threshold of %f:\n",
                llLength(clusters), threshold);
+        printClusters(clusters);
+    }
+    else if (max_clusters != num_clusters)
+    {
+        // l'arbre n'est construit qu'une fois pour tout l'intervalle
+        hclustMapClustersK(hc, num_clusters, max_clusters, printClustersK, NULL);
     }
     else
     {
         clusters = hclustGetClustersK(hc, num_clusters);
-        printf("Clusters for k=%d:\n", num_clusters);
+        printClustersK(num_clusters, clusters, NULL);
     }
 
-    Node *p = llHead(clusters);
-    int i = 1;
-    while (p != NULL)
+    if (lfile != NULL)
     {
-        printf("- Cluster %d (size=%zu)", i, llLength(llData(p)));
-        Node *first = llHead(llData(p));
-        Node *pp = first;
-        while (pp != NULL)
+        int *labels = malloc((size_t)hclustNbLeaves(hc) * sizeof(int));
+        if (labels == NULL)
         {
-            if (pp == first)
-                printf(": %s", (char *)llData(pp));
-            else
-                printf(", %s", (char *)llData(pp));
-            pp = llNext(pp);
+            fprintf(stderr, "Not enough memory for the labels.\n");
+            exit(1);
         }
-        printf("\n");
-        i++;
-        p = llNext(p);
+        if (use_threshold)
+            hclustLabelsDist(hc, threshold, labels);
+        else
+            hclustLabelsK(hc, num_clusters, labels);
+
+        printf("Writing the cluster labels in file %s.\n", lfile);
+        writeLabels(lfile, hc, labels);
+        free(labels);
     }
 
     FILE *foutput;
-    if (argc == 5)
+    if (ofile != NULL)
     {
-        printf("Outputing the tree in file %s.\n", argv[4]);
-        foutput = fopen(argv[4], "w");
+        printf("Outputing the tree in file %s.\n", ofile);
+        foutput = fopen(ofile, "w");
     }
     else
     {
@@ -208,12 +598,15 @@ int main(int argc, char *argv[])
     hclustPrintTree(foutput, hc);
 
 
-    for (Node *i = llHead(clusters); i != NULL; i = llNext(i))
+    if (clusters != NULL)
     {
-        List *inner = llData(i);
-        llFree(inner);
+        for (Node *i = llHead(clusters); i != NULL; i = llNext(i))
+        {
+            List *inner = llData(i);
+            llFree(inner);
+        }
+        llFree(clusters);
     }
-    llFree(clusters);
     hclustFree(hc);
     if (foutput != stderr)
         fclose(foutput);
@@ -10,13 +10,49 @@
 
 int main(int argc, char *argv[])
 {
+    // -nj: arbre construit par neighbor joining
+    // -mash <k> <s>: distance de Mash entre esquisses de s k-mers
+    PhyloOptions options;
+    phyloDefaultOptions(&options);
+    while (argc >= 2 && argv[1][0] == '-')
+    {
+        if (strcmp(argv[1], "-nj") == 0)
+        {
+            options.method = PHYLO_NJ;
+            argv++;
+            argc--;
+        }
+        else if (strcmp(argv[1], "-mash") == 0 && argc >= 4)
+        {
+            options.distance = PHYLO_MASH;
+            options.kmerSize = atoi(argv[2]);
+            options.sketchSize = atoi(argv[3]);
+            if (options.kmerSize < 1 || options.kmerSize > 32 || options.sketchSize < 1)
+            {
+                fprintf(stderr, "Invalid sketch: k must be between 1 and 32 and s positive.\n");
+                exit(0);
+            }
+            argv += 3;
+            argc -= 3;
+        }
+        else
+            break;
+    }
+
     if (argc < 2)
     {
-        fprintf(stderr, "No file names provided.\nUsage: hcphylo <input_file> [<output_file>]\n");
+        fprintf(stderr, "No file names provided.\n"
+                        "Usage: hcphylo [-nj] [-mash <k> <sketch_size>] <input_file> [<output_file>]\n");
         exit(0);
     }
 
-    Hclust *hc = phyloTreeCreate(argv[1]);
+    Hclust *hc = phyloTreeCreateOpt(argv[1], &options);
+    if (hc == NULL)
+    {
+        fprintf(stderr, "Unable to build the tree from %s (unreadable file or duplicate sequence name).\n",
+                argv[1]);
+        exit(EXIT_FAILURE);
+    }
 
     FILE *foutput;
     if (argc == 3)